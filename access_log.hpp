@@ -0,0 +1,331 @@
+#ifndef ACCESS_LOG_HPP
+#define	ACCESS_LOG_HPP
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace SimpleWeb {
+    /// Fixed size binary record of a request, copied into the ring of the thread that logs it.
+    /// Longer fields are truncated.
+    struct AccessRecord {
+        static const size_t method_capacity=16;
+        static const size_t version_capacity=8;
+        static const size_t address_capacity=46;
+        static const size_t path_capacity=256;
+
+        /// When the response was sent, in nanoseconds since the epoch
+        int64_t time;
+        /// From the first byte of the request until its response was sent, in nanoseconds.
+        /// 0 if WEB_SERVER_NO_METRICS is defined.
+        uint64_t duration;
+        /// Bytes of the response, header included
+        uint64_t bytes;
+        /// 0 if the response did not start with a status line
+        uint16_t status;
+        uint16_t port;
+        uint8_t method_size, version_size, address_size;
+        uint16_t path_size;
+        char method[method_capacity];
+        char version[version_capacity];
+        char address[address_capacity];
+        char path[path_capacity];
+
+        void set_method(boost::string_view value) {
+            method_size=static_cast<uint8_t>(copy(value, method, method_capacity));
+        }
+        void set_version(boost::string_view value) {
+            version_size=static_cast<uint8_t>(copy(value, version, version_capacity));
+        }
+        void set_address(boost::string_view value) {
+            address_size=static_cast<uint8_t>(copy(value, address, address_capacity));
+        }
+        void set_path(boost::string_view value) {
+            path_size=static_cast<uint16_t>(copy(value, path, path_capacity));
+        }
+
+    private:
+        static size_t copy(boost::string_view value, char *field, size_t capacity) {
+            auto size=std::min(value.size(), capacity);
+            std::memcpy(field, value.data(), size);
+            return size;
+        }
+    };
+
+    /// Access log written by a background thread.
+    ///
+    /// Each thread that logs gets its own single-producer single-consumer ring of AccessRecords, so that logging
+    /// a request copies a record without locks or system calls. The writer thread drains the rings every
+    /// flush_interval, formats the records in the Common Log Format followed by the duration in microseconds,
+    /// and writes them with few large writes. Records that find their ring full are dropped and counted, so that
+    /// a slow disk never blocks the threads that log.
+    ///
+    /// The file is rotated once it exceeds max_file_size, keeping max_files earlier files as path.1, path.2 and so
+    /// on, or reopened by reopen(), for instance after an external tool renamed it.
+    class AccessLog {
+    public:
+        struct Config {
+            /// Records per thread ring, a power of two. Defaults to 4096.
+            size_t ring_size=4096;
+            /// How often the writer drains the rings. Defaults to 100 ms.
+            std::chrono::milliseconds flush_interval=std::chrono::milliseconds(100);
+            /// Size at which the file is rotated. Defaults to 0, never.
+            size_t max_file_size=0;
+            /// Number of rotated files kept. Defaults to 5.
+            size_t max_files=5;
+        };
+
+        /// Opens path for appending and starts the writer thread. Throws std::runtime_error if path cannot be opened.
+        explicit AccessLog(const std::string &path) : AccessLog(path, Config()) {}
+        AccessLog(const std::string &path, const Config &config) :
+                path(path), config(config), id(next_id()) {
+            if(this->config.ring_size==0 || (this->config.ring_size&(this->config.ring_size-1))!=0)
+                throw std::invalid_argument("AccessLog: ring_size must be a power of two");
+            open();
+            if(fd<0)
+                throw std::runtime_error("AccessLog: could not open "+path);
+            writer=std::thread([this] {
+                this->run();
+            });
+        }
+        /// Writes the remaining records
+        ~AccessLog() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping=true;
+            }
+            wake.notify_all();
+            writer.join();
+            if(fd>=0)
+                ::close(fd);
+        }
+        AccessLog(const AccessLog&)=delete;
+        AccessLog &operator=(const AccessLog&)=delete;
+
+        /// Returns the next free record of the calling thread's ring, to be filled and then committed with commit(),
+        /// or nullptr if the ring is full, in which case the record is counted as dropped
+        AccessRecord *reserve() {
+            auto &ring=local();
+            auto tail=ring.tail.load(std::memory_order_relaxed);
+            if(tail-ring.head.load(std::memory_order_acquire)>=ring.records.size()) {
+                ring.dropped.store(ring.dropped.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            return &ring.records[tail&(ring.records.size()-1)];
+        }
+        /// Hands the record returned by reserve() to the writer
+        void commit() {
+            auto &ring=local();
+            ring.tail.store(ring.tail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+        }
+
+        /// Number of records dropped since the log was created
+        uint64_t dropped() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t sum=0;
+            for(auto &ring: rings)
+                sum+=ring->dropped.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+        /// Closes and reopens the file, once the records drained so far have been written
+        void reopen() {
+            reopen_requested.store(true, std::memory_order_relaxed);
+            wake.notify_all();
+        }
+
+    private:
+        struct Ring {
+            explicit Ring(size_t size) : thread_id(std::this_thread::get_id()), records(size) {}
+            std::thread::id thread_id;
+            std::vector<AccessRecord> records;
+            /// Written by the writer and by the producer respectively, on separate cache lines
+            alignas(64) std::atomic<uint64_t> head{0};
+            alignas(64) std::atomic<uint64_t> tail{0};
+            std::atomic<uint64_t> dropped{0};
+        };
+
+        std::string path;
+        Config config;
+        /// Distinguishes instances, since a new one may reuse the address of a destroyed one
+        const uint64_t id;
+        int fd=-1;
+        size_t file_size=0;
+
+        /// Guards rings and stopping
+        mutable std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+        bool stopping=false;
+        std::condition_variable wake;
+        std::atomic<bool> reopen_requested{false};
+        std::thread writer;
+
+        /// Output of the writer, written once it reaches write_size or the rings are drained
+        std::string buffer;
+        static const size_t write_size=65536;
+        time_t formatted_second=-1;
+        char formatted_time[32];
+
+        static uint64_t next_id() {
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+
+        /// The ring of the calling thread. Looked up once, unless the thread logs to several instances.
+        Ring &local() {
+            thread_local uint64_t cached_id=0;
+            thread_local Ring *cached_ring=nullptr;
+            if(cached_id==id)
+                return *cached_ring;
+            std::lock_guard<std::mutex> lock(mutex);
+            auto thread_id=std::this_thread::get_id();
+            cached_ring=nullptr;
+            for(auto &ring: rings) {
+                if(ring->thread_id==thread_id)
+                    cached_ring=ring.get();
+            }
+            if(!cached_ring) {
+                rings.emplace_back(new Ring(config.ring_size));
+                cached_ring=rings.back().get();
+            }
+            cached_id=id;
+            return *cached_ring;
+        }
+
+        void open() {
+            fd=::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            off_t end=fd>=0 ? lseek(fd, 0, SEEK_END) : 0;
+            file_size=end>0 ? static_cast<size_t>(end) : 0;
+        }
+
+        void run() {
+            std::vector<Ring*> snapshot;
+            while(true) {
+                bool stop;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait_for(lock, config.flush_interval, [this] {
+                        return stopping || reopen_requested.load(std::memory_order_relaxed);
+                    });
+                    stop=stopping;
+                    snapshot.clear();
+                    for(auto &ring: rings)
+                        snapshot.emplace_back(ring.get());
+                }
+                for(auto ring: snapshot)
+                    drain(*ring);
+                write_buffer();
+                if(reopen_requested.exchange(false, std::memory_order_relaxed)) {
+                    if(fd>=0)
+                        ::close(fd);
+                    open();
+                }
+                if(stop)
+                    return;
+            }
+        }
+
+        void drain(Ring &ring) {
+            auto head=ring.head.load(std::memory_order_relaxed);
+            auto tail=ring.tail.load(std::memory_order_acquire);
+            for(;head!=tail;head++) {
+                format(ring.records[head&(ring.records.size()-1)]);
+                //Frees the slots formatted so far, so that the producer does not drop while a large batch is formatted
+                if(buffer.size()>=write_size) {
+                    ring.head.store(head+1, std::memory_order_release);
+                    write_buffer();
+                }
+            }
+            ring.head.store(head, std::memory_order_release);
+        }
+
+        /// remote - - [10/Oct/2000:13:55:36 +0000] "GET /path HTTP/1.1" 200 2326 1234
+        void format(const AccessRecord &record) {
+            auto second=static_cast<time_t>(record.time/1000000000);
+            if(second!=formatted_second) {
+                struct tm tm;
+                gmtime_r(&second, &tm);
+                strftime(formatted_time, sizeof(formatted_time), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+                formatted_second=second;
+            }
+            buffer.append(record.address, record.address_size);
+            buffer+=" - - [";
+            buffer+=formatted_time;
+            buffer+="] \"";
+            append_escaped(record.method, record.method_size);
+            buffer+=' ';
+            append_escaped(record.path, record.path_size);
+            buffer+=" HTTP/";
+            append_escaped(record.version, record.version_size);
+            char numbers[80];
+            if(record.status>0)
+                snprintf(numbers, sizeof(numbers), "\" %u %llu %llu\n", record.status,
+                         static_cast<unsigned long long>(record.bytes), static_cast<unsigned long long>(record.duration/1000));
+            else
+                snprintf(numbers, sizeof(numbers), "\" - %llu %llu\n",
+                         static_cast<unsigned long long>(record.bytes), static_cast<unsigned long long>(record.duration/1000));
+            buffer+=numbers;
+        }
+
+        /// Appends a field of the request line. Quotes and control characters would break the line apart or forge the
+        /// fields after it, so they are written as \xNN, as is the backslash.
+        void append_escaped(const char *field, size_t size) {
+            for(size_t c=0;c<size;c++) {
+                auto character=field[c];
+                if(character=='"' || character=='\\' || static_cast<unsigned char>(character)<0x20) {
+                    char escaped[5];
+                    snprintf(escaped, sizeof(escaped), "\\x%02x", static_cast<unsigned char>(character));
+                    buffer+=escaped;
+                }
+                else
+                    buffer+=character;
+            }
+        }
+
+        void write_buffer() {
+            if(buffer.empty())
+                return;
+            if(config.max_file_size>0 && file_size>0 && file_size+buffer.size()>config.max_file_size)
+                rotate();
+            size_t written=0;
+            while(fd>=0 && written<buffer.size()) {
+                auto result=::write(fd, buffer.data()+written, buffer.size()-written);
+                if(result<0 && errno==EINTR)
+                    continue;
+                if(result<=0)
+                    break;
+                written+=static_cast<size_t>(result);
+            }
+            file_size+=written;
+            buffer.clear();
+        }
+
+        /// Renames path.n to path.n+1, down to path to path.1, dropping the oldest, and opens a new path
+        void rotate() {
+            if(fd>=0)
+                ::close(fd);
+            if(config.max_files>0) {
+                for(auto n=config.max_files-1;n>0;n--)
+                    ::rename((path+"."+std::to_string(n)).c_str(), (path+"."+std::to_string(n+1)).c_str());
+                ::rename(path.c_str(), (path+".1").c_str());
+            }
+            else
+                ::unlink(path.c_str());
+            open();
+        }
+    };
+}
+#endif	/* ACCESS_LOG_HPP */
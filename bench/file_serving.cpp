@@ -0,0 +1,76 @@
+#include "server_http.hpp"
+#include "static_file_cache.hpp"
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+using namespace std;
+
+//Compares the ways of producing the body of a file response: a StaticFileCache hit, which touches no file system,
+//opening the file for send_file(), and reading it into memory for every request.
+//The range argument is the file size.
+
+namespace {
+    class Files {
+    public:
+        Files() : root(boost::filesystem::temp_directory_path()/boost::filesystem::unique_path("bench-file-serving-%%%%%%%%")) {
+            boost::filesystem::create_directories(root);
+            for(auto size: {1024, 65536, 1048576}) {
+                ofstream ofs((root/name(size)).string(), ofstream::binary);
+                string content(static_cast<size_t>(size), 'x');
+                ofs.write(content.data(), static_cast<streamsize>(content.size()));
+            }
+        }
+        ~Files() {
+            boost::system::error_code ec;
+            boost::filesystem::remove_all(root, ec);
+        }
+        static string name(int64_t size) {
+            return "file"+to_string(size)+".bin";
+        }
+        string path(int64_t size) const {
+            return (root/name(size)).string();
+        }
+        boost::filesystem::path root;
+    };
+    const Files files;
+
+    void BM_StaticFileCacheHit(benchmark::State &state) {
+        boost::asio::io_service io_service;
+        SimpleWeb::StaticFileCache cache(io_service, files.root.string());
+        auto request_path="/"+Files::name(state.range(0));
+        if(!cache.get(request_path)) {
+            state.SkipWithError("not cacheable");
+            return;
+        }
+        for(auto _: state) {
+            auto entry=cache.get(request_path);
+            benchmark::DoNotOptimize(entry->body());
+        }
+    }
+    BENCHMARK(BM_StaticFileCacheHit)->Arg(1024)->Arg(65536)->Arg(1048576);
+
+    //What the uncached path does before send_file(): open and stat
+    void BM_FileOpen(benchmark::State &state) {
+        auto path=files.path(state.range(0));
+        for(auto _: state) {
+            SimpleWeb::File file(path);
+            benchmark::DoNotOptimize(file.size());
+        }
+    }
+    BENCHMARK(BM_FileOpen)->Arg(1024)->Arg(65536)->Arg(1048576);
+
+    //Reading the whole file with an ifstream for every request
+    void BM_ReadFile(benchmark::State &state) {
+        auto path=files.path(state.range(0));
+        string content;
+        for(auto _: state) {
+            ifstream ifs(path, ifstream::binary);
+            content.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+            benchmark::DoNotOptimize(content.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations())*state.range(0));
+    }
+    BENCHMARK(BM_ReadFile)->Arg(1024)->Arg(65536)->Arg(1048576);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+#include "server_http.hpp"
+#include <benchmark/benchmark.h>
+using namespace std;
+
+//Measures CaseInsensitiveHash and case_insensitive_equal, which every header lookup goes through,
+//and the lookups themselves on the headers of a typical browser request.
+
+namespace {
+    typedef unordered_multimap<string, string, SimpleWeb::CaseInsensitiveHash, SimpleWeb::CaseInsensitiveEqual> Header;
+
+    const vector<string> names={"Host", "Content-Length", "Accept-Encoding", "If-Modified-Since",
+                                "Sec-Fetch-Mode", "X-Forwarded-For-Original-Client-Address"};
+
+    void BM_CaseInsensitiveHash(benchmark::State &state) {
+        auto &name=names[static_cast<size_t>(state.range(0))];
+        SimpleWeb::CaseInsensitiveHash hash;
+        for(auto _: state)
+            benchmark::DoNotOptimize(hash(name));
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()*name.size()));
+    }
+    BENCHMARK(BM_CaseInsensitiveHash)->DenseRange(0, 5);
+
+    //Equal names in a different case, the usual case of a successful lookup
+    void BM_CaseInsensitiveEqual(benchmark::State &state) {
+        auto &name=names[static_cast<size_t>(state.range(0))];
+        auto other=name;
+        for(auto &c: other)
+            c=static_cast<char>(tolower(c));
+        for(auto _: state)
+            benchmark::DoNotOptimize(SimpleWeb::case_insensitive_equal(name, other));
+    }
+    BENCHMARK(BM_CaseInsensitiveEqual)->DenseRange(0, 5);
+
+    Header browser_header() {
+        return {{"Host", "www.example.com"}, {"Connection", "keep-alive"},
+                {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36"},
+                {"Accept", "text/css,*/*;q=0.1"}, {"Sec-Fetch-Site", "same-origin"}, {"Sec-Fetch-Mode", "no-cors"},
+                {"Sec-Fetch-Dest", "style"}, {"Referer", "https://www.example.com/"}, {"Accept-Encoding", "gzip, deflate, br"},
+                {"Accept-Language", "en-US,en;q=0.9"}, {"If-None-Match", "\"653f1a2b-1f40\""},
+                {"If-Modified-Since", "Mon, 30 Oct 2023 09:12:43 GMT"}};
+    }
+
+    //The lookups a static file request makes: found and missing headers
+    void BM_HeaderFind(benchmark::State &state) {
+        auto header=browser_header();
+        const string found="accept-encoding", missing="Content-Length";
+        for(auto _: state) {
+            benchmark::DoNotOptimize(header.find(found));
+            benchmark::DoNotOptimize(header.find(missing));
+        }
+    }
+    BENCHMARK(BM_HeaderFind);
+
+    //As Server::keep_alive() does for the Connection header
+    void BM_HeaderEqualRange(benchmark::State &state) {
+        auto header=browser_header();
+        const string name="connection";
+        for(auto _: state) {
+            auto range=header.equal_range(name);
+            for(auto it=range.first;it!=range.second;it++)
+                benchmark::DoNotOptimize(SimpleWeb::case_insensitive_equal(it->second, "close"));
+        }
+    }
+    BENCHMARK(BM_HeaderEqualRange);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,183 @@
+#include "server_http.hpp"
+#include "server_io_uring.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+using namespace std;
+
+//Compares the epoll and io_uring backends side by side: requests/sec, latency percentiles and
+//system calls per request made by the server, against a trivial handler with keep-alive connections.
+//Each server runs in a child process, whose system calls are counted with the raw_syscalls:sys_enter
+//tracepoint if perf events and tracefs are available.
+//Usage: bench_io_uring [client connections] [seconds per run]
+
+const string response_text="HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nHello World";
+
+template <class socket_type>
+void run_server(unsigned short port, int ready_fd) {
+    SimpleWeb::Server<socket_type> server;
+    server.config.port=port;
+    server.default_resource["GET"]=[](shared_ptr<typename SimpleWeb::Server<socket_type>::Response> response,
+                                      shared_ptr<typename SimpleWeb::Server<socket_type>::Request> /*request*/) {
+        *response << response_text;
+    };
+    thread notify([ready_fd] {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        char c=1;
+        if(write(ready_fd, &c, 1)<0)
+            exit(1);
+    });
+    notify.detach();
+    server.start();
+}
+
+/// Counts the system calls of pid and the threads it creates from now on, or returns -1
+int open_syscall_counter(pid_t pid) {
+    ifstream id_file("/sys/kernel/tracing/events/raw_syscalls/sys_enter/id");
+    if(!id_file)
+        id_file.open("/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id");
+    unsigned long long id;
+    if(!(id_file >> id))
+        return -1;
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type=PERF_TYPE_TRACEPOINT;
+    attr.size=sizeof(attr);
+    attr.config=id;
+    attr.inherit=1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+long long read_counter(int fd) {
+    long long count;
+    if(fd<0 || read(fd, &count, sizeof(count))!=sizeof(count))
+        return -1;
+    return count;
+}
+
+struct Result {
+    size_t requests=0;
+    vector<double> latencies;
+};
+
+/// Single threaded epoll client with one request in flight per connection
+Result run_clients(unsigned short port, size_t connections, double seconds) {
+    Result result;
+    auto epoll_fd=epoll_create1(0);
+    struct Client {
+        int fd;
+        size_t received=0;
+        chrono::steady_clock::time_point sent;
+    };
+    vector<Client> clients(connections);
+    const string request="GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family=AF_INET;
+    address.sin_port=htons(port);
+    address.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    for(size_t c=0;c<connections;c++) {
+        auto &client=clients[c];
+        client.fd=socket(AF_INET, SOCK_STREAM, 0);
+        int one=1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(connect(client.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))<0) {
+            cerr << "connect: " << strerror(errno) << endl;
+            exit(1);
+        }
+        epoll_event event;
+        event.events=EPOLLIN;
+        event.data.u64=c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.fd, &event);
+        client.sent=chrono::steady_clock::now();
+        if(write(client.fd, request.data(), request.size())<0)
+            exit(1);
+    }
+
+    auto end=chrono::steady_clock::now()+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    vector<epoll_event> events(connections);
+    char buffer[4096];
+    while(chrono::steady_clock::now()<end) {
+        auto count=epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 100);
+        auto now=chrono::steady_clock::now();
+        for(int c=0;c<count;c++) {
+            auto &client=clients[events[c].data.u64];
+            auto length=read(client.fd, buffer, sizeof(buffer));
+            if(length<=0) {
+                cerr << "connection closed" << endl;
+                exit(1);
+            }
+            client.received+=static_cast<size_t>(length);
+            if(client.received<response_text.size())
+                continue;
+            client.received-=response_text.size();
+            result.requests++;
+            result.latencies.emplace_back(chrono::duration<double, micro>(now-client.sent).count());
+            client.sent=now;
+            if(write(client.fd, request.data(), request.size())<0)
+                exit(1);
+        }
+    }
+    for(auto &client: clients)
+        close(client.fd);
+    close(epoll_fd);
+    return result;
+}
+
+template <class socket_type>
+void benchmark(const char *name, unsigned short port, size_t connections, double seconds) {
+    int ready[2];
+    if(pipe(ready)<0)
+        exit(1);
+    auto pid=fork();
+    if(pid==0) {
+        close(ready[0]);
+        run_server<socket_type>(port, ready[1]);
+        _exit(0);
+    }
+    close(ready[1]);
+    //Attached before the server creates its threads, which inherit the counter
+    auto counter=open_syscall_counter(pid);
+    char c;
+    if(read(ready[0], &c, 1)!=1) {
+        cout << name << ": server failed to start" << endl;
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    close(ready[0]);
+
+    auto syscalls_start=read_counter(counter);
+    auto result=run_clients(port, connections, seconds);
+    auto syscalls_end=read_counter(counter);
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    if(counter>=0)
+        close(counter);
+
+    sort(result.latencies.begin(), result.latencies.end());
+    auto percentile=[&result](double p) {
+        return result.latencies.empty() ? 0.0 : result.latencies[min(result.latencies.size()-1, static_cast<size_t>(p*result.latencies.size()))];
+    };
+    cout << name << ": " << static_cast<size_t>(result.requests/seconds) << " requests/sec, p50 " << percentile(0.5)
+         << " us, p99 " << percentile(0.99) << " us, ";
+    if(syscalls_start>=0 && syscalls_end>=0 && result.requests>0)
+        cout << static_cast<double>(syscalls_end-syscalls_start)/result.requests << " syscalls/request" << endl;
+    else
+        cout << "syscalls/request n/a" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    size_t connections=argc>1 ? strtoul(argv[1], nullptr, 10) : 64;
+    double seconds=argc>2 ? atof(argv[2]) : 3.0;
+
+    benchmark<SimpleWeb::HTTP>("epoll", 18180, connections, seconds);
+    benchmark<SimpleWeb::HTTP_URING>("io_uring", 18181, connections, seconds);
+    return 0;
+}
@@ -0,0 +1,766 @@
+#include "server_http.hpp"
+#include "chunked_encoding.hpp"
+#include <boost/asio.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+using namespace std;
+namespace asio=boost::asio;
+
+//HTTP load generator, closed or open loop, driven by a mix of requests.
+//
+//Closed loop: each connection keeps --pipeline requests in flight, sending the next one when a response arrives,
+//so the offered load adapts to the server. Open loop: requests are due at --rate per second over all connections,
+//whatever the server does, and the latency is measured from when a request was due rather than when it was sent,
+//so that a stalled server is not hidden by the generator waiting for it (coordinated omission).
+//
+//The mix is a JSON Lines file with one request per line, picked at random in proportion to weight:
+//  {"method": "GET", "path": "/hello/world", "headers": {"Accept-Encoding": "gzip"}, "body": "", "weight": 3}
+//
+//Prints requests/sec, responses per status class and latency percentiles. --hdr writes the latency distribution
+//in the percentile format of HdrHistogram, in milliseconds, for plotting. --min-rps and --max-p99 make it exit
+//with failure below the given throughput or above the given 99th percentile, for regression checks.
+//--serve runs the example routes of the default mix in process, for runs without a separate server.
+
+namespace {
+    void usage() {
+        cerr << "Usage: bench_load [options]\n"
+                "  --host <address>       server address, defaults to 127.0.0.1\n"
+                "  --port <port>          server port, defaults to 8080\n"
+                "  --mix <file>           request mix, defaults to " BENCH_MIX_PATH "\n"
+                "  --connections <n>      connections, defaults to 16\n"
+                "  --pipeline <n>         requests in flight per connection, defaults to 1\n"
+                "  --no-keep-alive        opens a connection per request\n"
+                "  --threads <n>          client threads, each with its own connections, defaults to 1\n"
+                "  --rate <n>             open loop at n requests/sec over all connections, defaults to 0, closed loop\n"
+                "  --duration <seconds>   measured time, defaults to 10\n"
+                "  --warmup <seconds>     time before measuring, defaults to 1\n"
+                "  --hdr <file>           writes the latency distribution in the HdrHistogram percentile format\n"
+                "  --min-rps <n>          fails below n requests/sec\n"
+                "  --max-p99 <ms>         fails above a 99th percentile latency of ms milliseconds\n"
+                "  --serve                runs the routes of the default mix on --port in this process\n"
+                ;
+    }
+
+    struct Options {
+        string host="127.0.0.1";
+        unsigned short port=8080;
+        string mix=BENCH_MIX_PATH;
+        size_t connections=16;
+        size_t pipeline=1;
+        bool keep_alive=true;
+        size_t threads=1;
+        double rate=0;
+        double duration=10;
+        double warmup=1;
+        string hdr;
+        double min_rps=0;
+        double max_p99=0;
+        bool serve=false;
+    };
+
+    /// Latency histogram with about 1% precision, log-linear like HdrHistogram:
+    /// 128 linear sub-buckets per power of two of nanoseconds
+    class Histogram {
+    public:
+        static const unsigned sub_bits=7;
+
+        Histogram() : counts((64-sub_bits+1)<<sub_bits, 0) {}
+
+        void record(uint64_t value) {
+            counts[index(value)]++;
+            total++;
+            sum+=static_cast<double>(value);
+            sum_squares+=static_cast<double>(value)*static_cast<double>(value);
+            max=std::max(max, value);
+        }
+        void add(const Histogram &other) {
+            for(size_t c=0;c<counts.size();c++)
+                counts[c]+=other.counts[c];
+            total+=other.total;
+            sum+=other.sum;
+            sum_squares+=other.sum_squares;
+            max=std::max(max, other.max);
+        }
+        uint64_t count() const {
+            return total;
+        }
+        /// Highest value equivalent to the value at percentile, in [0, 100]
+        uint64_t percentile(double percentile) const {
+            if(total==0)
+                return 0;
+            auto rank=static_cast<uint64_t>(std::ceil(percentile/100*static_cast<double>(total)));
+            rank=std::max<uint64_t>(rank, 1);
+            uint64_t seen=0;
+            for(size_t c=0;c<counts.size();c++) {
+                seen+=counts[c];
+                if(seen>=rank)
+                    return std::min(highest_equivalent(c), max);
+            }
+            return max;
+        }
+        double mean() const {
+            return total>0 ? sum/static_cast<double>(total) : 0;
+        }
+        double standard_deviation() const {
+            if(total==0)
+                return 0;
+            auto m=mean();
+            return std::sqrt(std::max(0.0, sum_squares/static_cast<double>(total)-m*m));
+        }
+
+        /// Writes the distribution like HdrHistogram's outputPercentileDistribution, scaled by unit nanoseconds
+        void write_percentiles(ostream &stream, double unit) const {
+            char line[128];
+            stream << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+            //Five percentiles per halving of the distance to 100%
+            for(unsigned tick=0;;tick++) {
+                auto fraction=1-std::pow(0.5, tick/5.0);
+                auto value=percentile(fraction*100);
+                uint64_t below=0;
+                for(size_t c=0;c<counts.size() && highest_equivalent(c)<=value;c++)
+                    below+=counts[c];
+                if(below>=total || tick>=100) {
+                    snprintf(line, sizeof(line), "%12.3f %14.12f %10llu\n", static_cast<double>(max)/unit, 1.0,
+                             static_cast<unsigned long long>(total));
+                    stream << line;
+                    break;
+                }
+                snprintf(line, sizeof(line), "%12.3f %14.12f %10llu %14.2f\n", static_cast<double>(value)/unit, fraction,
+                         static_cast<unsigned long long>(below), 1/(1-fraction));
+                stream << line;
+            }
+            snprintf(line, sizeof(line), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean()/unit, standard_deviation()/unit);
+            stream << line;
+            snprintf(line, sizeof(line), "#[Max     = %12.3f, Total count    = %12llu]\n", static_cast<double>(max)/unit,
+                     static_cast<unsigned long long>(total));
+            stream << line;
+            snprintf(line, sizeof(line), "#[Buckets = %12u, SubBuckets     = %12u]\n", 64-sub_bits, 1u<<sub_bits);
+            stream << line;
+        }
+
+    private:
+        vector<uint64_t> counts;
+        uint64_t total=0, max=0;
+        double sum=0, sum_squares=0;
+
+        static size_t index(uint64_t value) {
+            if(value<(1ull<<sub_bits))
+                return static_cast<size_t>(value);
+            auto shift=63-__builtin_clzll(value)-sub_bits;
+            return (static_cast<size_t>(shift+1)<<sub_bits)+static_cast<size_t>((value>>shift)&((1ull<<sub_bits)-1));
+        }
+        static uint64_t highest_equivalent(size_t index) {
+            if(index<(1ull<<sub_bits))
+                return index;
+            auto shift=(index>>sub_bits)-1;
+            auto lowest=static_cast<uint64_t>((index&((1ull<<sub_bits)-1))|(1ull<<sub_bits))<<shift;
+            return lowest+((1ull<<shift)-1);
+        }
+    };
+
+    struct MixRequest {
+        string bytes;
+        unsigned weight;
+    };
+
+    /// Reads the mix, serializing each request once
+    vector<MixRequest> read_mix(const Options &options) {
+        ifstream ifs(options.mix);
+        if(!ifs)
+            throw runtime_error("could not read mix "+options.mix);
+        vector<MixRequest> mix;
+        string line;
+        while(getline(ifs, line)) {
+            auto first=line.find_first_not_of(" \t\r");
+            if(first==string::npos)
+                continue;
+            boost::property_tree::ptree tree;
+            istringstream stream(line);
+            boost::property_tree::read_json(stream, tree);
+            auto method=tree.get<string>("method", "GET");
+            auto body=tree.get<string>("body", "");
+            MixRequest request;
+            request.weight=tree.get<unsigned>("weight", 1);
+            request.bytes=method+" "+tree.get<string>("path")+" HTTP/1.1\r\nHost: "+options.host+"\r\n";
+            if(auto headers=tree.get_child_optional("headers")) {
+                for(auto &header: *headers)
+                    request.bytes+=header.first+": "+header.second.data()+"\r\n";
+            }
+            if(!options.keep_alive)
+                request.bytes+="Connection: close\r\n";
+            if(!body.empty() || method=="POST" || method=="PUT")
+                request.bytes+="Content-Length: "+to_string(body.size())+"\r\n";
+            request.bytes+="\r\n"+body;
+            if(request.weight>0)
+                mix.emplace_back(std::move(request));
+        }
+        if(mix.empty())
+            throw runtime_error("no requests in mix "+options.mix);
+        return mix;
+    }
+
+    /// Finds the end of the responses in a receive buffer, without copying their content
+    class ResponseParser {
+    public:
+        enum class Result {complete, incomplete, bad_response};
+
+        /// On complete, size is the number of bytes of data taken by the response
+        Result parse(const char *data, size_t size, size_t &response_size) {
+            if(header_size==0) {
+                auto end=static_cast<const char*>(memmem(data, size, "\r\n\r\n", 4));
+                if(!end)
+                    return size>65536 ? Result::bad_response : Result::incomplete;
+                header_size=static_cast<size_t>(end-data)+4;
+                if(header_size<12 || memcmp(data, "HTTP/1.", 7)!=0)
+                    return Result::bad_response;
+                status=static_cast<unsigned>(atoi(data+9));
+                parse_header(data, header_size);
+                position=header_size;
+            }
+            if(chunked) {
+                while(true) {
+                    size_t consumed, piece_size;
+                    const char *piece;
+                    auto result=decoder.next(data+position, size-position, consumed, piece, piece_size);
+                    position+=consumed;
+                    if(result==SimpleWeb::ChunkedDecoder::Result::complete)
+                        break;
+                    if(result==SimpleWeb::ChunkedDecoder::Result::bad_request)
+                        return Result::bad_response;
+                    if(result==SimpleWeb::ChunkedDecoder::Result::incomplete)
+                        return Result::incomplete;
+                }
+            }
+            else if(content_length>=0) {
+                if(size-header_size<static_cast<size_t>(content_length))
+                    return Result::incomplete;
+                position=header_size+static_cast<size_t>(content_length);
+            }
+            else
+                return Result::incomplete; //Ends when the connection is closed
+            response_size=position;
+            return Result::complete;
+        }
+        /// For responses without length, at the end of the connection
+        size_t close_delimited_size(size_t size) const {
+            return header_size>0 && !chunked && content_length<0 ? size : 0;
+        }
+        void reset() {
+            header_size=0;
+            position=0;
+            content_length=-1;
+            chunked=false;
+            close=false;
+            decoder.reset();
+        }
+
+        unsigned status=0;
+        bool close=false;
+
+    private:
+        size_t header_size=0, position=0;
+        long long content_length=-1;
+        bool chunked=false;
+        SimpleWeb::ChunkedDecoder decoder;
+
+        static bool starts_with(const char *line, size_t size, const char *name) {
+            auto length=strlen(name);
+            return size>length && strncasecmp(line, name, length)==0;
+        }
+
+        void parse_header(const char *data, size_t size) {
+            auto line=static_cast<const char*>(memchr(data, '\n', size))+1;
+            auto end=data+size;
+            while(line<end) {
+                auto line_end=static_cast<const char*>(memchr(line, '\n', static_cast<size_t>(end-line)));
+                auto line_size=static_cast<size_t>(line_end-line);
+                if(starts_with(line, line_size, "content-length:"))
+                    content_length=atoll(line+15);
+                else if(starts_with(line, line_size, "transfer-encoding:"))
+                    chunked=strncasecmp(line_end-8, "chunked", 7)==0 || strncasecmp(line_end-7, "chunked", 7)==0;
+                else if(starts_with(line, line_size, "connection:"))
+                    close=strncasecmp(line_end-6, "close", 5)==0 || strncasecmp(line_end-5, "close", 5)==0;
+                line=line_end+1;
+            }
+            //No content, whatever the headers say
+            if(status==204 || status==304 || (status>=100 && status<200))
+                content_length=0;
+        }
+    };
+
+    class Worker;
+
+    /// A client connection. Reconnects after errors and, without keep-alive, after every response.
+    class Connection : public enable_shared_from_this<Connection> {
+    public:
+        Connection(Worker &worker, size_t index, size_t connections);
+        void start();
+        void stop();
+
+    private:
+        Worker &worker;
+        size_t index, connections;
+        asio::ip::tcp::socket socket;
+        asio::steady_timer due_timer, retry_timer;
+        /// Incremented on reconnecting, so that handlers of the previous socket do nothing
+        unsigned generation=0;
+        bool connected=false, writing=false, stopped=false;
+        /// Bytes of the write in progress, and of the requests queued behind it
+        string write_buffer, queued_buffer;
+        /// Received bytes, starting with the first response not yet complete
+        vector<char> read_buffer;
+        size_t read_size=0;
+        ResponseParser parser;
+        /// When each request in flight was sent, or due in the open loop
+        deque<chrono::steady_clock::time_point> in_flight;
+        /// Requests due in the open loop and not yet sent
+        deque<chrono::steady_clock::time_point> due;
+        chrono::steady_clock::time_point next_due, connect_started;
+        chrono::steady_clock::duration interval;
+
+        void connect();
+        void schedule();
+        void send();
+        void write();
+        void read();
+        void parse();
+        void reconnect();
+        void failed();
+    };
+
+    /// The connections of a client thread, with its own io_service and results
+    class Worker {
+    public:
+        Worker(const Options &options, const vector<MixRequest> &mix, size_t connections, unsigned seed) :
+                options(options), mix(mix), random(seed), end_timer(io_service) {
+            unsigned total=0;
+            for(auto &request: mix)
+                cumulative_weights.emplace_back(total+=request.weight);
+            for(size_t c=0;c<connections;c++)
+                this->connections.emplace_back(make_shared<Connection>(*this, c, connections));
+        }
+
+        /// Connects at start, records the responses to requests sent from measure_start, and stops at end
+        void run(chrono::steady_clock::time_point start, chrono::steady_clock::time_point measure_start,
+                 chrono::steady_clock::time_point end) {
+            this->start=start;
+            this->measure_start=measure_start;
+            endpoint=asio::ip::tcp::endpoint(asio::ip::address::from_string(options.host), options.port);
+            for(auto &connection: connections)
+                connection->start();
+            end_timer.expires_at(end);
+            end_timer.async_wait([this](const boost::system::error_code&) {
+                stopping=true;
+                for(auto &connection: connections)
+                    connection->stop();
+            });
+            io_service.run();
+        }
+
+        const MixRequest &pick() {
+            auto value=uniform_int_distribution<unsigned>(1, cumulative_weights.back())(random);
+            return mix[static_cast<size_t>(lower_bound(cumulative_weights.begin(), cumulative_weights.end(), value)-
+                                           cumulative_weights.begin())];
+        }
+
+        void completed(chrono::steady_clock::time_point sent, unsigned status, size_t size) {
+            if(sent<measure_start)
+                return;
+            auto latency=chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-sent).count();
+            histogram.record(latency>0 ? static_cast<uint64_t>(latency) : 0);
+            statuses[std::min(status/100, 5u)]++;
+            bytes+=size;
+        }
+        void error() {
+            if(chrono::steady_clock::now()>=measure_start)
+                errors++;
+        }
+
+        const Options &options;
+        asio::io_service io_service;
+        asio::ip::tcp::endpoint endpoint;
+        chrono::steady_clock::time_point start, measure_start;
+        bool stopping=false;
+
+        Histogram histogram;
+        /// Responses by status class, 0 for unparsable status codes
+        uint64_t statuses[6]={0, 0, 0, 0, 0, 0};
+        uint64_t errors=0;
+        uint64_t bytes=0;
+
+    private:
+        const vector<MixRequest> &mix;
+        vector<unsigned> cumulative_weights;
+        mt19937 random;
+        vector<shared_ptr<Connection>> connections;
+        asio::steady_timer end_timer;
+    };
+
+    Connection::Connection(Worker &worker, size_t index, size_t connections) : worker(worker), index(index), connections(connections),
+            socket(worker.io_service), due_timer(worker.io_service), retry_timer(worker.io_service), read_buffer(65536) {
+        //Each connection sends its share of the rate
+        if(worker.options.rate>0)
+            interval=chrono::duration_cast<chrono::steady_clock::duration>(
+                    chrono::duration<double>(static_cast<double>(worker.options.connections)/worker.options.rate));
+    }
+
+    void Connection::start() {
+        if(worker.options.rate>0) {
+            //Offset so that the connections do not send in step
+            next_due=worker.start+interval*static_cast<long>(index)/static_cast<long>(connections);
+            schedule();
+        }
+        connect();
+    }
+
+    void Connection::stop() {
+        stopped=true;
+        boost::system::error_code ec;
+        socket.close(ec);
+        due_timer.cancel();
+        retry_timer.cancel();
+    }
+
+    void Connection::connect() {
+        connected=false;
+        connect_started=chrono::steady_clock::now();
+        auto self=shared_from_this();
+        socket.async_connect(worker.endpoint, [self, this, generation=generation](const boost::system::error_code &ec) {
+            if(stopped || generation!=this->generation)
+                return;
+            if(ec) {
+                failed();
+                return;
+            }
+            boost::system::error_code option_ec;
+            socket.set_option(asio::ip::tcp::no_delay(true), option_ec);
+            connected=true;
+            read();
+            send();
+        });
+    }
+
+    void Connection::schedule() {
+        due_timer.expires_at(next_due);
+        auto self=shared_from_this();
+        due_timer.async_wait([self, this](const boost::system::error_code &ec) {
+            if(ec || stopped)
+                return;
+            for(auto now=chrono::steady_clock::now();next_due<=now;next_due+=interval)
+                due.emplace_back(next_due);
+            send();
+            schedule();
+        });
+    }
+
+    /// Queues requests up to the pipeline depth: as many as fit in the closed loop, those due in the open loop
+    void Connection::send() {
+        if(!connected || stopped)
+            return;
+        auto pipeline=worker.options.keep_alive ? std::max<size_t>(worker.options.pipeline, 1) : 1;
+        if(worker.options.rate>0) {
+            for(;!due.empty() && in_flight.size()<pipeline;due.pop_front()) {
+                queued_buffer+=worker.pick().bytes;
+                in_flight.emplace_back(due.front());
+            }
+        }
+        else {
+            //Without keep-alive, the latency includes connecting
+            auto sent=worker.options.keep_alive ? chrono::steady_clock::now() : connect_started;
+            while(in_flight.size()<pipeline) {
+                queued_buffer+=worker.pick().bytes;
+                in_flight.emplace_back(sent);
+            }
+        }
+        write();
+    }
+
+    void Connection::write() {
+        if(writing || queued_buffer.empty())
+            return;
+        write_buffer.swap(queued_buffer);
+        queued_buffer.clear();
+        writing=true;
+        auto self=shared_from_this();
+        asio::async_write(socket, asio::buffer(write_buffer), [self, this, generation=generation](const boost::system::error_code &ec, size_t) {
+            if(stopped || generation!=this->generation)
+                return;
+            writing=false;
+            if(ec) {
+                failed();
+                return;
+            }
+            write();
+        });
+    }
+
+    void Connection::read() {
+        if(read_size==read_buffer.size())
+            read_buffer.resize(read_buffer.size()*2);
+        auto self=shared_from_this();
+        socket.async_read_some(asio::buffer(read_buffer.data()+read_size, read_buffer.size()-read_size),
+                [self, this, generation=generation](const boost::system::error_code &ec, size_t bytes_transferred) {
+            if(stopped || generation!=this->generation)
+                return;
+            if(ec) {
+                //A response without length ends with the connection
+                if(ec==asio::error::eof && parser.close_delimited_size(read_size)>0 && !in_flight.empty()) {
+                    worker.completed(in_flight.front(), parser.status, read_size);
+                    in_flight.pop_front();
+                    reconnect();
+                }
+                else
+                    failed();
+                return;
+            }
+            read_size+=bytes_transferred;
+            parse();
+        });
+    }
+
+    void Connection::parse() {
+        size_t position=0;
+        while(true) {
+            size_t size;
+            auto result=parser.parse(read_buffer.data()+position, read_size-position, size);
+            if(result==ResponseParser::Result::incomplete)
+                break;
+            if(result==ResponseParser::Result::bad_response || in_flight.empty()) {
+                failed();
+                return;
+            }
+            worker.completed(in_flight.front(), parser.status, size);
+            in_flight.pop_front();
+            auto close=parser.close || !worker.options.keep_alive;
+            parser.reset();
+            position+=size;
+            if(close) {
+                reconnect();
+                return;
+            }
+        }
+        if(position>0) {
+            memmove(read_buffer.data(), read_buffer.data()+position, read_size-position);
+            read_size-=position;
+        }
+        send();
+        read();
+    }
+
+    /// Drops the connection and the requests in flight on it, and connects again
+    void Connection::reconnect() {
+        generation++;
+        boost::system::error_code ec;
+        socket.close(ec);
+        connected=false;
+        writing=false;
+        write_buffer.clear();
+        queued_buffer.clear();
+        read_size=0;
+        parser.reset();
+        in_flight.clear();
+        if(!worker.stopping)
+            connect();
+    }
+
+    /// Counts the requests in flight as errors, and connects again after a pause, so that a server that refuses
+    /// connections is not hammered
+    void Connection::failed() {
+        worker.error();
+        for(size_t c=1;c<in_flight.size();c++)
+            worker.error();
+        generation++;
+        boost::system::error_code ec;
+        socket.close(ec);
+        connected=false;
+        in_flight.clear();
+        retry_timer.expires_from_now(chrono::milliseconds(10));
+        auto self=shared_from_this();
+        retry_timer.async_wait([self, this](const boost::system::error_code &ec) {
+            if(!ec && !stopped)
+                reconnect();
+        });
+    }
+
+    typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
+
+    /// The routes of the default mix, as in web_server.cpp, without compression
+    void add_routes(HttpServer &server) {
+        server.route("GET", "/hello/{name}", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+            auto content="Hello "+request->path_parameters.get("name").to_string()+"!";
+            response->write_status(200).write_date_header().write_header("Content-Length", content.length()).end_header();
+            *response << content;
+        });
+        server.route("POST", "/echo", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+            auto content=request->content.string();
+            response->write_status(200).write_header("Content-Length", content.length()).end_header();
+            *response << content;
+        });
+        server.route("GET", "/numbers/{count}", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+            unsigned long long count;
+            if(!SimpleWeb::parse_decimal(request->path_parameters.get("count"), count) || count>1000000) {
+                response->write_status(400).write_header("Content-Length", 0).end_header();
+                return;
+            }
+            string content;
+            for(unsigned long long c=0;c<count;c++)
+                content+=to_string(c)+"\n";
+            response->write_status(200).write_header("Content-Type", "text/plain").write_header("Content-Length", content.length()).end_header();
+            *response << content;
+        });
+    }
+
+    bool parse_options(int argc, char *argv[], Options &options) {
+        for(int c=1;c<argc;c++) {
+            string name=argv[c];
+            auto value=[&]() -> string {
+                if(c+1>=argc)
+                    throw invalid_argument("missing value of "+name);
+                return argv[++c];
+            };
+            if(name=="--host")
+                options.host=value();
+            else if(name=="--port")
+                options.port=static_cast<unsigned short>(stoul(value()));
+            else if(name=="--mix")
+                options.mix=value();
+            else if(name=="--connections")
+                options.connections=std::max<size_t>(stoul(value()), 1);
+            else if(name=="--pipeline")
+                options.pipeline=std::max<size_t>(stoul(value()), 1);
+            else if(name=="--no-keep-alive")
+                options.keep_alive=false;
+            else if(name=="--threads")
+                options.threads=std::max<size_t>(stoul(value()), 1);
+            else if(name=="--rate")
+                options.rate=stod(value());
+            else if(name=="--duration")
+                options.duration=stod(value());
+            else if(name=="--warmup")
+                options.warmup=stod(value());
+            else if(name=="--hdr")
+                options.hdr=value();
+            else if(name=="--min-rps")
+                options.min_rps=stod(value());
+            else if(name=="--max-p99")
+                options.max_p99=stod(value());
+            else if(name=="--serve")
+                options.serve=true;
+            else
+                return false;
+        }
+        options.threads=std::min(options.threads, options.connections);
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    vector<MixRequest> mix;
+    try {
+        if(!parse_options(argc, argv, options)) {
+            usage();
+            return 1;
+        }
+        mix=read_mix(options);
+    }
+    catch(const exception &e) {
+        cerr << "bench_load: " << e.what() << endl;
+        return 1;
+    }
+
+    HttpServer server;
+    thread server_thread;
+    if(options.serve) {
+        server.config.port=options.port;
+        server.config.address=options.host;
+        add_routes(server);
+        server_thread=thread([&server] {
+            server.start();
+        });
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+
+    vector<unique_ptr<Worker>> workers;
+    for(size_t c=0;c<options.threads;c++) {
+        auto connections=options.connections/options.threads+(c<options.connections%options.threads ? 1 : 0);
+        workers.emplace_back(new Worker(options, mix, connections, static_cast<unsigned>(c+1)));
+    }
+    auto start=chrono::steady_clock::now();
+    auto measure_start=start+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.warmup));
+    auto end=measure_start+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.duration));
+    vector<thread> threads;
+    for(auto &worker: workers) {
+        threads.emplace_back([&worker, start, measure_start, end] {
+            worker->run(start, measure_start, end);
+        });
+    }
+    for(auto &thread: threads)
+        thread.join();
+
+    if(options.serve) {
+        server.stop();
+        server_thread.join();
+    }
+
+    Histogram histogram;
+    uint64_t statuses[6]={0, 0, 0, 0, 0, 0}, errors=0, bytes=0;
+    for(auto &worker: workers) {
+        histogram.add(worker->histogram);
+        for(size_t c=0;c<6;c++)
+            statuses[c]+=worker->statuses[c];
+        errors+=worker->errors;
+        bytes+=worker->bytes;
+    }
+
+    auto rps=static_cast<double>(histogram.count())/options.duration;
+    const double ms=1e6;
+    printf("%s loop, %zu connections, pipeline %zu%s, %zu threads\n", options.rate>0 ? "open" : "closed", options.connections,
+           options.keep_alive ? options.pipeline : 1, options.keep_alive ? "" : ", no keep-alive", options.threads);
+    printf("%llu responses in %.1f s: %.0f requests/sec, %.2f MB/sec\n", static_cast<unsigned long long>(histogram.count()),
+           options.duration, rps, static_cast<double>(bytes)/options.duration/1e6);
+    printf("1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu, errors %llu\n",
+           static_cast<unsigned long long>(statuses[1]), static_cast<unsigned long long>(statuses[2]),
+           static_cast<unsigned long long>(statuses[3]), static_cast<unsigned long long>(statuses[4]),
+           static_cast<unsigned long long>(statuses[5]), static_cast<unsigned long long>(statuses[0]),
+           static_cast<unsigned long long>(errors));
+    printf("latency ms: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", histogram.mean()/ms,
+           static_cast<double>(histogram.percentile(50))/ms, static_cast<double>(histogram.percentile(90))/ms,
+           static_cast<double>(histogram.percentile(99))/ms, static_cast<double>(histogram.percentile(99.9))/ms,
+           static_cast<double>(histogram.percentile(100))/ms);
+
+    if(!options.hdr.empty()) {
+        ofstream hdr(options.hdr);
+        histogram.write_percentiles(hdr, ms);
+        if(!hdr) {
+            cerr << "bench_load: could not write " << options.hdr << endl;
+            return 1;
+        }
+    }
+
+    auto failed=false;
+    if(options.min_rps>0 && rps<options.min_rps) {
+        printf("FAILED: %.0f requests/sec is below %.0f\n", rps, options.min_rps);
+        failed=true;
+    }
+    auto p99=static_cast<double>(histogram.percentile(99))/ms;
+    if(options.max_p99>0 && p99>options.max_p99) {
+        printf("FAILED: p99 of %.3f ms is above %.3f ms\n", p99, options.max_p99);
+        failed=true;
+    }
+    return failed ? 1 : 0;
+}
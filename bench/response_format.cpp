@@ -0,0 +1,84 @@
+#include "response_format.hpp"
+#include <boost/asio.hpp>
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <initializer_list>
+#include <ostream>
+using namespace std;
+
+//Compares building a response with operator<<, as Response did before write_status() and friends,
+//with the preformatted status line, the cached Date header and locale free integer formatting.
+//Both write to an asio::streambuf, like Response. The range argument is the content size.
+
+namespace {
+    const string content(65536, 'x');
+
+    void BM_Ostream(benchmark::State &state) {
+        boost::asio::streambuf streambuf;
+        ostream stream(&streambuf);
+        auto size=static_cast<size_t>(state.range(0));
+        for(auto _: state) {
+            stream << "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " << size << "\r\n\r\n";
+            stream.write(content.data(), size);
+            benchmark::DoNotOptimize(streambuf.data());
+            streambuf.consume(streambuf.size());
+        }
+    }
+    BENCHMARK(BM_Ostream)->Arg(16)->Arg(4096);
+
+    //As above, with a Date header formatted for every response
+    void BM_OstreamWithDate(benchmark::State &state) {
+        boost::asio::streambuf streambuf;
+        ostream stream(&streambuf);
+        auto size=static_cast<size_t>(state.range(0));
+        for(auto _: state) {
+            auto now=time(nullptr);
+            struct tm tm;
+            gmtime_r(&now, &tm);
+            char date[64];
+            strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+            stream << "HTTP/1.1 200 OK\r\nDate: " << date << "\r\nContent-Type: text/plain\r\nContent-Length: " << size << "\r\n\r\n";
+            stream.write(content.data(), size);
+            benchmark::DoNotOptimize(streambuf.data());
+            streambuf.consume(streambuf.size());
+        }
+    }
+    BENCHMARK(BM_OstreamWithDate)->Arg(16)->Arg(4096);
+
+    //Copies parts with one reservation, like Response::append()
+    void append(boost::asio::streambuf &streambuf, initializer_list<boost::string_view> parts) {
+        size_t size=0;
+        for(auto &part: parts)
+            size+=part.size();
+        auto buffer=boost::asio::buffer_cast<char*>(streambuf.prepare(size));
+        for(auto &part: parts) {
+            memcpy(buffer, part.data(), part.size());
+            buffer+=part.size();
+        }
+        streambuf.commit(size);
+    }
+
+    //The sequence of Response::write_status(), write_date_header(), write_header() and end_header(),
+    //with the content appended as a buffer to send without copying, as Response::write_buffer() does
+    void BM_ResponseFormat(benchmark::State &state) {
+        boost::asio::streambuf streambuf;
+        vector<boost::asio::const_buffer> buffers;
+        auto size=static_cast<size_t>(state.range(0));
+        for(auto _: state) {
+            append(streambuf, {SimpleWeb::status_line(200)});
+            append(streambuf, {SimpleWeb::date_header()});
+            append(streambuf, {"Content-Type", ": ", "text/plain", "\r\n"});
+            char digits[20];
+            append(streambuf, {"Content-Length", ": ", boost::string_view(digits, SimpleWeb::format_decimal(size, digits)), "\r\n"});
+            append(streambuf, {"\r\n"});
+            buffers.emplace_back(streambuf.data());
+            buffers.emplace_back(content.data(), size);
+            benchmark::DoNotOptimize(buffers.data());
+            buffers.clear();
+            streambuf.consume(streambuf.size());
+        }
+    }
+    BENCHMARK(BM_ResponseFormat)->Arg(16)->Arg(4096);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,87 @@
+#include "server_http.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
+
+//Measures requests/sec against a trivial handler for 1, 2, 4, ... threads,
+//both with a shared io_service and with one io_service per thread (SO_REUSEPORT).
+//Usage: bench_thread_scaling [max threads] [client connections] [seconds per run]
+
+size_t run_clients(unsigned short port, size_t connections, double seconds) {
+    atomic<bool> done(false);
+    atomic<size_t> total(0);
+    vector<thread> clients;
+    for(size_t c=0;c<connections;c++) {
+        clients.emplace_back([&]() {
+            boost::asio::io_service io_service;
+            boost::asio::ip::tcp::socket socket(io_service);
+            SimpleWeb::error_code ec;
+            socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), ec);
+            if(ec)
+                return;
+            const string request="GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            boost::asio::streambuf streambuf;
+            size_t count=0;
+            while(!done) {
+                boost::asio::write(socket, boost::asio::buffer(request), ec);
+                if(ec)
+                    break;
+                size_t header_length=boost::asio::read_until(socket, streambuf, "\r\n\r\n", ec);
+                if(ec)
+                    break;
+                string header(boost::asio::buffers_begin(streambuf.data()), boost::asio::buffers_begin(streambuf.data())+header_length);
+                streambuf.consume(header_length);
+                auto pos=header.find("Content-Length: ");
+                size_t content_length=pos!=string::npos ? stoul(header.substr(pos+16)) : 0;
+                if(streambuf.size()<content_length)
+                    boost::asio::read(socket, streambuf, boost::asio::transfer_exactly(content_length-streambuf.size()), ec);
+                if(ec)
+                    break;
+                streambuf.consume(content_length);
+                count++;
+            }
+            total+=count;
+        });
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    done=true;
+    for(auto &t: clients)
+        t.join();
+    return total;
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_threads=argc>1 ? strtoul(argv[1], nullptr, 10) : thread::hardware_concurrency();
+    size_t connections=argc>2 ? strtoul(argv[2], nullptr, 10) : 64;
+    double seconds=argc>3 ? atof(argv[3]) : 3.0;
+    if(max_threads==0)
+        max_threads=1;
+
+    unsigned short port=18080;
+    for(int per_thread=0;per_thread<2;per_thread++) {
+        for(size_t threads=1;threads<=max_threads;threads*=2) {
+            HttpServer server;
+            server.config.port=port;
+            server.config.thread_pool_size=threads;
+            server.config.io_service_per_thread=per_thread;
+            server.default_resource["GET"]=[](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+                *response << "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nHello World";
+            };
+            thread server_thread([&server]() {
+                server.start();
+            });
+            this_thread::sleep_for(chrono::milliseconds(200));
+
+            size_t requests=run_clients(port, connections, seconds);
+            cout << (per_thread ? "io_service per thread" : "shared io_service") << ", " << threads << " thread(s): "
+                 << static_cast<size_t>(requests/seconds) << " requests/sec" << endl;
+
+            server.stop();
+            server_thread.join();
+            port++;
+        }
+    }
+    return 0;
+}
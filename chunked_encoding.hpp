@@ -0,0 +1,172 @@
+#ifndef CHUNKED_ENCODING_HPP
+#define	CHUNKED_ENCODING_HPP
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace SimpleWeb {
+    /// Incremental decoder of content with Transfer-Encoding: chunked.
+    ///
+    /// next() works directly on the receive buffer and returns the content as slices of it, so that nothing is copied
+    /// or allocated. Chunk extensions and trailers are skipped.
+    class ChunkedDecoder {
+    public:
+        enum class Result {content, incomplete, complete, bad_request};
+
+        /// Maximum length of a chunk size line, including any extensions, and of a trailer line
+        size_t max_line_size=4096;
+
+        /// Prepare for new content
+        void reset() {
+            state=State::size;
+            chunk_remaining=0;
+            line_size=0;
+            digits=0;
+        }
+
+        /// Decodes data[0, size), the bytes received and not yet consumed.
+        ///
+        /// Returns content with the next slice of content in [piece, piece+piece_size), which ends at data+consumed.
+        /// Returns incomplete once the framing in data has been consumed and more data is needed, and complete once the
+        /// last chunk and the trailers have been consumed. In every case, the caller consumes consumed bytes of data
+        /// before the next call.
+        Result next(const char *data, size_t size, size_t &consumed, const char *&piece, size_t &piece_size) {
+            consumed=0;
+            while(consumed<size) {
+                auto c=data[consumed];
+                switch(state) {
+                case State::size:
+                case State::extension:
+                case State::size_lf:
+                    if(++line_size>max_line_size)
+                        return Result::bad_request;
+                    if(state==State::size_lf) {
+                        if(c!='\n')
+                            return Result::bad_request;
+                        end_size_line();
+                    }
+                    else if(c=='\n') {
+                        if(digits==0)
+                            return Result::bad_request;
+                        end_size_line();
+                    }
+                    else if(state==State::extension) {
+                        //Chunk extensions are skipped
+                    }
+                    else if(hex_value(c)>=0) {
+                        //Reject sizes that do not fit in 60 bits
+                        if(++digits>15)
+                            return Result::bad_request;
+                        chunk_remaining=chunk_remaining*16+static_cast<uint64_t>(hex_value(c));
+                    }
+                    else if(digits==0)
+                        return Result::bad_request;
+                    else if(c==';' || c==' ' || c=='\t')
+                        state=State::extension;
+                    else if(c=='\r')
+                        state=State::size_lf;
+                    else
+                        return Result::bad_request;
+                    break;
+                case State::data: {
+                    auto available=std::min(static_cast<uint64_t>(size-consumed), chunk_remaining);
+                    piece=data+consumed;
+                    piece_size=static_cast<size_t>(available);
+                    consumed+=piece_size;
+                    chunk_remaining-=available;
+                    if(chunk_remaining==0)
+                        state=State::data_cr;
+                    return Result::content;
+                }
+                case State::data_cr:
+                    if(c=='\r')
+                        state=State::data_lf;
+                    else if(c=='\n')
+                        state=State::size;
+                    else
+                        return Result::bad_request;
+                    break;
+                case State::data_lf:
+                    if(c!='\n')
+                        return Result::bad_request;
+                    state=State::size;
+                    break;
+                case State::trailer:
+                    if(c=='\n') {
+                        if(line_size==0) {
+                            consumed++;
+                            state=State::done;
+                            return Result::complete;
+                        }
+                        line_size=0;
+                    }
+                    else if(c!='\r' && ++line_size>max_line_size)
+                        return Result::bad_request;
+                    break;
+                case State::done:
+                    return Result::complete;
+                }
+                consumed++;
+            }
+            return state==State::done ? Result::complete : Result::incomplete;
+        }
+
+        /// Returns true if data[0, size) holds the rest of the content, without consuming it
+        bool is_complete(const char *data, size_t size) const {
+            auto decoder=*this;
+            size_t position=0;
+            while(true) {
+                size_t consumed;
+                const char *piece;
+                size_t piece_size;
+                auto result=decoder.next(data+position, size-position, consumed, piece, piece_size);
+                position+=consumed;
+                if(result!=Result::content)
+                    return result==Result::complete;
+            }
+        }
+
+    private:
+        enum class State {size, extension, size_lf, data, data_cr, data_lf, trailer, done};
+        State state=State::size;
+        uint64_t chunk_remaining=0;
+        size_t line_size=0;
+        size_t digits=0;
+
+        void end_size_line() {
+            line_size=0;
+            digits=0;
+            //The last chunk is followed by the trailers, if any, and an empty line
+            state=chunk_remaining==0 ? State::trailer : State::data;
+        }
+
+        static int hex_value(char c) {
+            if(c>='0' && c<='9')
+                return c-'0';
+            if(c>='a' && c<='f')
+                return c-'a'+10;
+            if(c>='A' && c<='F')
+                return c-'A'+10;
+            return -1;
+        }
+    };
+
+    /// Formats the line preceding a chunk of size bytes into buffer, which must hold at least chunk_header_size bytes.
+    /// Returns the length of the line.
+    static const size_t chunk_header_size=20;
+    inline size_t chunk_header(size_t size, char *buffer) {
+        static const char digits[]="0123456789abcdef";
+        char reversed[16];
+        size_t length=0;
+        do {
+            reversed[length++]=digits[size%16];
+            size/=16;
+        } while(size>0);
+        for(size_t c=0;c<length;c++)
+            buffer[c]=reversed[length-1-c];
+        buffer[length++]='\r';
+        buffer[length++]='\n';
+        return length;
+    }
+}
+#endif	/* CHUNKED_ENCODING_HPP */
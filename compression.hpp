@@ -0,0 +1,221 @@
+#ifndef COMPRESSION_HPP
+#define	COMPRESSION_HPP
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <boost/utility/string_view.hpp>
+#include <zlib.h>
+
+namespace SimpleWeb {
+    /// Content codings, as flags
+    namespace ContentEncoding {
+        static const unsigned identity=0;
+        static const unsigned gzip=1;
+        static const unsigned br=2;
+    }
+
+    /// Returns the content codings, among gzip and br, that an Accept-Encoding header value accepts,
+    /// as ContentEncoding flags. Codings with q=0 are refused, and * stands for the codings not listed.
+    inline unsigned accepted_encodings(boost::string_view accept_encoding) {
+        unsigned accepted=0, listed=0;
+        bool any=false;
+        while(!accept_encoding.empty()) {
+            auto end=accept_encoding.find(',');
+            auto element=accept_encoding.substr(0, end);
+            accept_encoding=end==boost::string_view::npos ? boost::string_view() : accept_encoding.substr(end+1);
+
+            auto parameters=element.find(';');
+            auto coding=element.substr(0, parameters);
+            while(!coding.empty() && (coding.front()==' ' || coding.front()=='\t'))
+                coding.remove_prefix(1);
+            while(!coding.empty() && (coding.back()==' ' || coding.back()=='\t'))
+                coding.remove_suffix(1);
+            //Only q=0, q=0.0 and so on refuse a coding
+            bool refused=false;
+            if(parameters!=boost::string_view::npos) {
+                auto q=element.find("q=", parameters);
+                if(q==boost::string_view::npos)
+                    q=element.find("Q=", parameters);
+                if(q!=boost::string_view::npos) {
+                    refused=true;
+                    for(auto c: element.substr(q+2)) {
+                        if(c>='1' && c<='9') {
+                            refused=false;
+                            break;
+                        }
+                        if(c!='0' && c!='.')
+                            break;
+                    }
+                }
+            }
+
+            unsigned flag=0;
+            auto is=[&coding](const char *name) {
+                auto length=std::strlen(name);
+                return coding.size()==length && std::equal(coding.begin(), coding.end(), name, [](char a, char b) {
+                    return tolower(a)==b;
+                });
+            };
+            if(is("gzip") || is("x-gzip"))
+                flag=ContentEncoding::gzip;
+            else if(is("br"))
+                flag=ContentEncoding::br;
+            else if(coding=="*") {
+                any=!refused;
+                continue;
+            }
+            listed|=flag;
+            if(!refused)
+                accepted|=flag;
+        }
+        if(any)
+            accepted|=(ContentEncoding::gzip | ContentEncoding::br) & ~listed;
+        return accepted;
+    }
+
+    /// Returns true if content of content_type is worth compressing, which excludes already compressed formats
+    inline bool is_compressible(boost::string_view content_type) {
+        static const char *types[]={"text/", "application/javascript", "application/json", "application/xml",
+                                    "application/wasm", "image/svg+xml", "image/x-icon"};
+        for(auto type: types) {
+            if(content_type.starts_with(type))
+                return true;
+        }
+        return false;
+    }
+
+    /// Incremental gzip compressor
+    class GzipStream {
+    public:
+        /// level is a zlib compression level, from 1 to 9
+        explicit GzipStream(int level=Z_DEFAULT_COMPRESSION) {
+            stream.zalloc=Z_NULL;
+            stream.zfree=Z_NULL;
+            stream.opaque=Z_NULL;
+            //15 window bits, plus 16 for a gzip header and trailer
+            if(deflateInit2(&stream, level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+                throw std::runtime_error("could not initialize zlib");
+        }
+        ~GzipStream() {
+            deflateEnd(&stream);
+        }
+        GzipStream(const GzipStream&)=delete;
+        GzipStream &operator=(const GzipStream&)=delete;
+
+        /// Compresses data[0, size) and appends the output, if any, to out.
+        /// flush is Z_NO_FLUSH, Z_SYNC_FLUSH to output everything compressed so far, or Z_FINISH to end the stream.
+        void compress(const char *data, size_t size, std::string &out, int flush=Z_NO_FLUSH) {
+            if(size>std::numeric_limits<uInt>::max())
+                throw std::length_error("gzip input too large");
+            stream.next_in=reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            stream.avail_in=static_cast<uInt>(size);
+            while(true) {
+                auto position=out.size();
+                auto available=std::max(static_cast<size_t>(deflateBound(&stream, stream.avail_in)), static_cast<size_t>(4096));
+                out.resize(position+available);
+                stream.next_out=reinterpret_cast<Bytef*>(&out[position]);
+                stream.avail_out=static_cast<uInt>(available);
+                auto result=deflate(&stream, flush);
+                out.resize(position+available-stream.avail_out);
+                if(result==Z_STREAM_ERROR)
+                    throw std::runtime_error("gzip compression failed");
+                if(stream.avail_in==0 && stream.avail_out>0 && (flush!=Z_FINISH || result==Z_STREAM_END))
+                    return;
+            }
+        }
+
+    private:
+        z_stream stream;
+    };
+
+    /// Returns data[0, size) compressed with gzip
+    inline std::string gzip(const char *data, size_t size, int level=Z_DEFAULT_COMPRESSION) {
+        GzipStream stream(level);
+        std::string out;
+        stream.compress(data, size, out, Z_FINISH);
+        return out;
+    }
+
+    /// Writes the content of a dynamic response, compressed with gzip as it is written if the client accepts it.
+    ///
+    /// The content is held back until it reaches min_size. Smaller content is sent as is with Content-Length,
+    /// so that tiny bodies are never compressed. Larger content is sent with Transfer-Encoding: chunked,
+    /// compressed if gzip is accepted. Response is a ServerBase<socket_type>::Response.
+    template <class Response>
+    class CompressedContentWriter {
+    public:
+        /// Write the status line and the other header fields to response before writing content
+        CompressedContentWriter(std::shared_ptr<Response> response, unsigned accepted_encodings, size_t min_size=1024,
+                                int level=Z_DEFAULT_COMPRESSION) :
+                response(std::move(response)), use_gzip(accepted_encodings & ContentEncoding::gzip), min_size(min_size),
+                level(level) {}
+
+        void write(const char *data, size_t size) {
+            if(!started) {
+                if(held.size()+size<min_size) {
+                    held.append(data, size);
+                    return;
+                }
+                start();
+                write_content(held.data(), held.size(), Z_NO_FLUSH);
+                held.clear();
+            }
+            write_content(data, size, Z_NO_FLUSH);
+        }
+        void write(boost::string_view data) {
+            write(data.data(), data.size());
+        }
+
+        /// Makes all the content written so far ready to be sent, for instance before Server::send()
+        void flush() {
+            if(started)
+                write_content(nullptr, 0, Z_SYNC_FLUSH);
+        }
+
+        /// Ends the content. Must be called once all of it has been written.
+        void end() {
+            if(!started) {
+                response->write_header("Vary", "Accept-Encoding").write_header("Content-Length", held.size()).end_header();
+                response->write(held.data(), static_cast<std::streamsize>(held.size()));
+                return;
+            }
+            write_content(nullptr, 0, Z_FINISH);
+            response->write_last_chunk();
+        }
+
+    private:
+        std::shared_ptr<Response> response;
+        bool use_gzip;
+        size_t min_size;
+        int level;
+        bool started=false;
+        std::string held, compressed;
+        std::unique_ptr<GzipStream> gzip_stream;
+
+        void start() {
+            started=true;
+            response->write_header("Vary", "Accept-Encoding");
+            if(use_gzip) {
+                gzip_stream=std::unique_ptr<GzipStream>(new GzipStream(level));
+                response->write_header("Content-Encoding", "gzip");
+            }
+            response->write_header("Transfer-Encoding", "chunked").end_header();
+        }
+
+        void write_content(const char *data, size_t size, int flush) {
+            if(!gzip_stream) {
+                response->write_chunk(data, size);
+                return;
+            }
+            compressed.clear();
+            gzip_stream->compress(data, size, compressed, flush);
+            response->write_chunk(compressed.data(), compressed.size());
+        }
+    };
+}
+#endif	/* COMPRESSION_HPP */
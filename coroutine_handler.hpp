@@ -0,0 +1,207 @@
+#ifndef COROUTINE_HANDLER_HPP
+#define	COROUTINE_HANDLER_HPP
+
+#include "server_http.hpp"
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <new>
+#include <boost/asio/steady_timer.hpp>
+
+namespace SimpleWeb {
+    /// Return type of resource functions written as C++20 coroutines. Requires C++20.
+    ///
+    /// Such a resource function takes the response and the request by value, and awaits the content, the sending of
+    /// what it has written so far and timers instead of passing callbacks:
+    ///
+    ///     server.route("POST", "/echo", [](std::shared_ptr<HttpServer::Response> response,
+    ///                                      std::shared_ptr<HttpServer::Request> request) -> SimpleWeb::CoroutineHandler {
+    ///         *response << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    ///         while(true) {
+    ///             auto content=co_await SimpleWeb::read_content(request);
+    ///             if(content.ec)
+    ///                 co_return;
+    ///             response->write_chunk(static_cast<const char*>(content.data.data()), content.data.size());
+    ///             if(content.data.size()==0 || co_await SimpleWeb::flush(response))
+    ///                 co_return;
+    ///         }
+    ///     }, true);
+    ///
+    /// The coroutine starts when the resource function is called and runs until its first co_await, and the response
+    /// is released when it ends. Its frame is allocated from memory owned by the connection and reused by the
+    /// following coroutines, and the awaitables use the memory of the connection for their operations, so that
+    /// streaming content allocates nothing per piece. An exception escaping the coroutine is answered with 500 like one
+    /// escaping a resource function, or closes the connection if part of the response has been sent already.
+    class CoroutineHandler {
+    public:
+        class promise_type {
+        public:
+            /// For lambdas, whose closure object comes first
+            template <class Closure, class Response, class Request>
+            promise_type(Closure&, const std::shared_ptr<Response> &response, const std::shared_ptr<Request> &request) :
+                    promise_type(response, request) {}
+            template <class Response, class Request>
+            promise_type(const std::shared_ptr<Response> &response, const std::shared_ptr<Request> &request) :
+                    response(&response), request(&request), fail(&CoroutineHandler::fail<Response, Request>) {}
+
+            template <class Closure, class Response, class Request>
+            static void *operator new(size_t size, Closure&, const std::shared_ptr<Response> &response, const std::shared_ptr<Request>&) {
+                return allocate(size, response->connection ?
+                                std::shared_ptr<FrameMemory>(response->connection, &response->connection->frame_memory) : nullptr);
+            }
+            template <class Response, class Request>
+            static void *operator new(size_t size, const std::shared_ptr<Response> &response, const std::shared_ptr<Request>&) {
+                return allocate(size, response->connection ?
+                                std::shared_ptr<FrameMemory>(response->connection, &response->connection->frame_memory) : nullptr);
+            }
+            static void operator delete(void *pointer, size_t /*size*/) {
+                auto header=reinterpret_cast<FrameHeader*>(static_cast<char*>(pointer)-header_size);
+                auto memory=std::move(header->memory);
+                header->~FrameHeader();
+                if(memory)
+                    memory->deallocate(header);
+                else
+                    ::operator delete(header);
+            }
+
+            CoroutineHandler get_return_object() {
+                return CoroutineHandler();
+            }
+            std::suspend_never initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+            void return_void() {}
+            void unhandled_exception() {
+                fail(response, request);
+            }
+
+        private:
+            /// The parameters of the coroutine, in its frame
+            const void *response, *request;
+            void (*fail)(const void*, const void*);
+
+            /// Keeps the memory, and so the connection owning it, until the frame has been freed
+            struct FrameHeader {
+                std::shared_ptr<FrameMemory> memory;
+            };
+            static const size_t header_size=(sizeof(FrameHeader)+alignof(std::max_align_t)-1)/alignof(std::max_align_t)*
+                                            alignof(std::max_align_t);
+
+            static void *allocate(size_t size, std::shared_ptr<FrameMemory> &&memory) {
+                auto header=memory ? memory->allocate(header_size+size) : ::operator new(header_size+size);
+                new(header) FrameHeader{std::move(memory)};
+                return static_cast<char*>(header)+header_size;
+            }
+        };
+
+        /// Result of awaiting read_content(): the next piece of the content, empty once all of it has been read
+        struct Content {
+            error_code ec;
+            asio::const_buffer data;
+        };
+
+        template <class Request>
+        class ReadContent {
+        public:
+            explicit ReadContent(Request &request) : request(request) {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> coroutine) {
+                //May resume the coroutine right away, so this is not used after the call
+                request.read_content([this, coroutine](const error_code &ec, asio::const_buffer data) {
+                    content.ec=ec;
+                    content.data=data;
+                    coroutine.resume();
+                });
+            }
+            Content await_resume() const noexcept {
+                return content;
+            }
+        private:
+            Request &request;
+            Content content;
+        };
+
+        template <class Response>
+        class Flush {
+        public:
+            explicit Flush(const std::shared_ptr<Response> &response) : response(response) {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> coroutine) {
+                response->connection->server->send(response, [this, coroutine](const error_code &ec) {
+                    this->ec=ec;
+                    coroutine.resume();
+                });
+            }
+            error_code await_resume() const noexcept {
+                return ec;
+            }
+        private:
+            std::shared_ptr<Response> response;
+            error_code ec;
+        };
+
+        class Sleep {
+        public:
+            template <class Response>
+            Sleep(const std::shared_ptr<Response> &response, std::chrono::steady_clock::duration duration) :
+                    timer(response->connection->socket.get_executor(), duration), memory(response->connection->handler_memory) {}
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> coroutine) {
+                timer.async_wait(make_handler(memory, [this, coroutine](const error_code &ec) {
+                    this->ec=ec;
+                    coroutine.resume();
+                }));
+            }
+            error_code await_resume() const noexcept {
+                return ec;
+            }
+        private:
+            asio::steady_timer timer;
+            HandlerMemory &memory;
+            error_code ec;
+        };
+
+    private:
+        template <class Response, class Request>
+        static void fail(const void *response_parameter, const void *request_parameter) {
+            auto &response=*static_cast<const std::shared_ptr<Response>*>(response_parameter);
+            auto &request=*static_cast<const std::shared_ptr<Request>*>(request_parameter);
+            //Answered with 500 like a resource function that throws, or closed if part of the response has been sent
+            if(response->connection && response->connection->server)
+                response->connection->server->resource_function_failed(response, request);
+            else
+                response->close_connection_after_response=true;
+        }
+    };
+
+    /// Awaits the next piece of the content of request, for routes added with stream_content.
+    /// The piece is valid until the next call. See ServerBase::Request::read_content().
+    template <class Request>
+    inline CoroutineHandler::ReadContent<Request> read_content(const std::shared_ptr<Request> &request) {
+        return CoroutineHandler::ReadContent<Request>(*request);
+    }
+
+    /// Awaits the sending of what has been written to response so far, and returns the error, if any.
+    /// See ServerBase::send().
+    template <class Response>
+    inline CoroutineHandler::Flush<Response> flush(const std::shared_ptr<Response> &response) {
+        return CoroutineHandler::Flush<Response>(response);
+    }
+
+    /// Resumes after duration, on the io_service of the connection of response
+    template <class Response, class Rep, class Period>
+    inline CoroutineHandler::Sleep sleep_for(const std::shared_ptr<Response> &response, std::chrono::duration<Rep, Period> duration) {
+        return CoroutineHandler::Sleep(response, std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+    }
+}
+#endif	/* COROUTINE_HANDLER_HPP */
@@ -0,0 +1,154 @@
+#ifndef HANDLER_ALLOCATOR_HPP
+#define	HANDLER_ALLOCATOR_HPP
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <boost/asio.hpp>
+
+namespace SimpleWeb {
+    /// A few fixed-size blocks of memory owned by a connection, reused for its completion handlers
+    /// and other short-lived objects. Requests that do not fit, or arrive while all blocks are in use,
+    /// fall back to the heap.
+    class HandlerMemory {
+    public:
+        /// Large enough for the operation state of a gather write, which holds a window of the buffers
+        static const size_t block_size=512;
+        static const size_t blocks=4;
+
+        HandlerMemory() {
+            for(auto &flag: in_use)
+                flag.store(false, std::memory_order_relaxed);
+        }
+        HandlerMemory(const HandlerMemory&)=delete;
+        HandlerMemory &operator=(const HandlerMemory&)=delete;
+
+        void *allocate(size_t size) {
+            if(size<=block_size) {
+                for(size_t c=0;c<blocks;c++) {
+                    if(!in_use[c].exchange(true, std::memory_order_acquire))
+                        return storage[c];
+                }
+            }
+            return ::operator new(size);
+        }
+
+        void deallocate(void *pointer) {
+            for(size_t c=0;c<blocks;c++) {
+                if(pointer==storage[c]) {
+                    in_use[c].store(false, std::memory_order_release);
+                    return;
+                }
+            }
+            ::operator delete(pointer);
+        }
+
+    private:
+        alignas(std::max_align_t) unsigned char storage[blocks][block_size];
+        std::atomic<bool> in_use[blocks];
+    };
+
+    /// A block of memory owned by a connection, reused for one coroutine frame at a time. The block grows to the
+    /// largest frame allocated from it. Frames allocated while the block is in use fall back to the heap.
+    class FrameMemory {
+    public:
+        FrameMemory() {
+            in_use.store(false, std::memory_order_relaxed);
+        }
+        ~FrameMemory() {
+            ::operator delete(storage);
+        }
+        FrameMemory(const FrameMemory&)=delete;
+        FrameMemory &operator=(const FrameMemory&)=delete;
+
+        void *allocate(size_t size) {
+            if(in_use.exchange(true, std::memory_order_acquire))
+                return ::operator new(size);
+            if(size>capacity) {
+                ::operator delete(storage);
+                storage=nullptr;
+                capacity=0;
+                try {
+                    storage=::operator new(size);
+                }
+                catch(...) {
+                    in_use.store(false, std::memory_order_release);
+                    throw;
+                }
+                capacity=size;
+            }
+            return storage;
+        }
+
+        void deallocate(void *pointer) {
+            if(pointer==storage)
+                in_use.store(false, std::memory_order_release);
+            else
+                ::operator delete(pointer);
+        }
+
+    private:
+        void *storage=nullptr;
+        size_t capacity=0;
+        std::atomic<bool> in_use;
+    };
+
+    /// Standard allocator using HandlerMemory. Used as the associated allocator of completion handlers,
+    /// and for the control blocks of shared_ptr.
+    template <class T>
+    class HandlerAllocator {
+        template <class U>
+        friend class HandlerAllocator;
+    public:
+        typedef T value_type;
+
+        explicit HandlerAllocator(HandlerMemory &memory) : memory(&memory) {}
+        template <class U>
+        HandlerAllocator(const HandlerAllocator<U> &other) : memory(other.memory) {}
+
+        T *allocate(size_t n) {
+            return static_cast<T*>(memory->allocate(sizeof(T)*n));
+        }
+        void deallocate(T *pointer, size_t /*n*/) {
+            memory->deallocate(pointer);
+        }
+
+        template <class U>
+        bool operator==(const HandlerAllocator<U> &other) const {
+            return memory==other.memory;
+        }
+        template <class U>
+        bool operator!=(const HandlerAllocator<U> &other) const {
+            return memory!=other.memory;
+        }
+    private:
+        HandlerMemory *memory;
+    };
+
+    /// Wraps a completion handler so that asio allocates its operation state from memory
+    template <class Handler>
+    class HandlerWithAllocator {
+    public:
+        typedef HandlerAllocator<Handler> allocator_type;
+
+        HandlerWithAllocator(HandlerMemory &memory, Handler handler) : memory(memory), handler(std::move(handler)) {}
+
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(memory);
+        }
+
+        template <class... Args>
+        void operator()(Args&&... args) {
+            handler(std::forward<Args>(args)...);
+        }
+    private:
+        HandlerMemory &memory;
+        Handler handler;
+    };
+
+    template <class Handler>
+    inline HandlerWithAllocator<Handler> make_handler(HandlerMemory &memory, Handler handler) {
+        return HandlerWithAllocator<Handler>(memory, std::move(handler));
+    }
+}
+#endif	/* HANDLER_ALLOCATOR_HPP */
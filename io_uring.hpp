@@ -0,0 +1,695 @@
+#ifndef IO_URING_HPP
+#define	IO_URING_HPP
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/system/system_error.hpp>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace SimpleWeb {
+    namespace asio = boost::asio;
+
+    /// An io_uring instance driving the sockets of one io_service, through the raw system calls so that liburing
+    /// is not needed. Requires Linux 6.0 or later.
+    ///
+    /// Submissions are batched: they are queued in the submission ring and handed to the kernel with one
+    /// io_uring_enter() once the completions at hand have been handled, or from a handler posted to the io_service.
+    /// Completions are signalled through an eventfd watched by the io_service, and handled on its thread.
+    /// Received data lands in a ring of buffers provided to the kernel, shared by all the sockets.
+    class IoUring : public std::enable_shared_from_this<IoUring> {
+    public:
+        /// An operation in progress, identified by its address in the user_data of its submissions
+        class Operation {
+        public:
+            /// Called on the io_service with the result and flags of each completion
+            virtual void complete(int result, unsigned flags)=0;
+        protected:
+            ~Operation() {}
+        };
+
+        /// entries is the size of the submission ring. buffers, a power of two, and buffer_size are the number and size
+        /// of the receive buffers. Throws boost::system::system_error if io_uring or one of its features is unavailable.
+        IoUring(asio::io_service &io_service, unsigned entries=1024, unsigned buffers=512, size_t buffer_size=8192) :
+                io_service(io_service), event(io_service), buffer_size(buffer_size) {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            params.flags=IORING_SETUP_CQSIZE;
+            params.cq_entries=entries*4;
+            fd=static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if(fd<0)
+                throw_error("io_uring_setup");
+            if((params.features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE))!=
+               (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE)) {
+                ::close(fd);
+                throw boost::system::system_error(asio::error::operation_not_supported, "io_uring features");
+            }
+
+            ring_size=std::max(params.sq_off.array+params.sq_entries*sizeof(unsigned),
+                               params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe));
+            ring=mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            sqes_size=params.sq_entries*sizeof(io_uring_sqe);
+            sqes=static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                  fd, IORING_OFF_SQES));
+            if(ring==MAP_FAILED || sqes==MAP_FAILED) {
+                auto error=errno;
+                release();
+                errno=error;
+                throw_error("mmap");
+            }
+            auto base=static_cast<char*>(ring);
+            sq_head=reinterpret_cast<unsigned*>(base+params.sq_off.head);
+            sq_tail=reinterpret_cast<unsigned*>(base+params.sq_off.tail);
+            sq_flags=reinterpret_cast<unsigned*>(base+params.sq_off.flags);
+            sq_mask=*reinterpret_cast<unsigned*>(base+params.sq_off.ring_mask);
+            sq_entries=params.sq_entries;
+            //Submission slots are used in order
+            auto array=reinterpret_cast<unsigned*>(base+params.sq_off.array);
+            for(unsigned c=0;c<sq_entries;c++)
+                array[c]=c;
+            cq_head=reinterpret_cast<unsigned*>(base+params.cq_off.head);
+            cq_tail=reinterpret_cast<unsigned*>(base+params.cq_off.tail);
+            cq_mask=*reinterpret_cast<unsigned*>(base+params.cq_off.ring_mask);
+            cqes=reinterpret_cast<io_uring_cqe*>(base+params.cq_off.cqes);
+            tail=*sq_tail;
+
+            //Provided buffer ring, group 0
+            buffer_ring_size=buffers*sizeof(io_uring_buf);
+            buffer_ring=static_cast<io_uring_buf_ring*>(mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE,
+                                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            buffer_memory=static_cast<char*>(mmap(nullptr, buffers*buffer_size, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            buffer_count=buffers;
+            if(buffer_ring==MAP_FAILED || buffer_memory==MAP_FAILED) {
+                auto error=errno;
+                release();
+                errno=error;
+                throw_error("mmap");
+            }
+            io_uring_buf_reg registration;
+            std::memset(&registration, 0, sizeof(registration));
+            registration.ring_addr=reinterpret_cast<uint64_t>(buffer_ring);
+            registration.ring_entries=buffers;
+            registration.bgid=0;
+            if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1)<0) {
+                auto error=errno;
+                release();
+                errno=error;
+                throw_error("io_uring_register buffer ring");
+            }
+            for(unsigned c=0;c<buffers;c++)
+                release_buffer(static_cast<uint16_t>(c));
+
+            auto event_fd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(event_fd<0 || syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &event_fd, 1)<0) {
+                auto error=errno;
+                if(event_fd>=0)
+                    ::close(event_fd);
+                release();
+                errno=error;
+                throw_error("io_uring_register eventfd");
+            }
+            event.assign(event_fd);
+        }
+        ~IoUring() {
+            release();
+        }
+        IoUring(const IoUring&)=delete;
+        IoUring &operator=(const IoUring&)=delete;
+
+        asio::io_service &get_io_service() {
+            return io_service;
+        }
+
+        /// Starts handling completions. Call once, after construction.
+        void start() {
+            wait_for_completions();
+        }
+
+        /// Data received into buffer id, which is returned to the kernel with release_buffer()
+        const char *buffer(uint16_t id) const {
+            return buffer_memory+static_cast<size_t>(id)*buffer_size;
+        }
+        /// Called on the io_service
+        void release_buffer(uint16_t id) {
+            //Not bufs, which the kernel header offsets by an empty struct when compiled as C++
+            auto &entry=reinterpret_cast<io_uring_buf*>(buffer_ring)[buffer_tail&(buffer_count-1)];
+            entry.addr=reinterpret_cast<uint64_t>(buffer_memory+static_cast<size_t>(id)*buffer_size);
+            entry.len=static_cast<uint32_t>(buffer_size);
+            entry.bid=id;
+            buffer_tail++;
+            __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+        }
+
+        /// Receives on socket into the provided buffers until cancelled or the connection ends
+        void receive_multishot(int socket, Operation *operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto sqe=next_sqe(IORING_OP_RECV, socket, operation);
+            if(!sqe)
+                return;
+            sqe->ioprio=IORING_RECV_MULTISHOT;
+            sqe->flags=IOSQE_BUFFER_SELECT;
+            sqe->buf_group=0;
+        }
+
+        /// Accepts non-blocking connections on socket until cancelled or an error occurs
+        void accept_multishot(int socket, Operation *operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto sqe=next_sqe(IORING_OP_ACCEPT, socket, operation);
+            if(!sqe)
+                return;
+            sqe->ioprio=IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags=SOCK_NONBLOCK | SOCK_CLOEXEC;
+        }
+
+        /// message, with its iovecs, only needs to be valid until the submission has been handed to the kernel
+        void send_message(int socket, const msghdr *message, Operation *operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto sqe=next_sqe(IORING_OP_SENDMSG, socket, operation);
+            if(!sqe)
+                return;
+            sqe->addr=reinterpret_cast<uint64_t>(message);
+            sqe->len=1;
+            sqe->msg_flags=MSG_NOSIGNAL;
+        }
+
+        void poll(int socket, unsigned events, Operation *operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto sqe=next_sqe(IORING_OP_POLL_ADD, socket, operation);
+            if(!sqe)
+                return;
+            sqe->poll32_events=events;
+        }
+
+        /// Cancels the submissions of operation. They complete with -ECANCELED, unless they have completed already.
+        void cancel(Operation *operation) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto sqe=next_sqe(IORING_OP_ASYNC_CANCEL, -1, nullptr);
+            if(!sqe) {
+                //Tried again once the completions at hand have been handled
+                auto self=shared_from_this();
+                asio::post(io_service, [self, operation] {
+                    self->cancel(operation);
+                });
+                return;
+            }
+            sqe->addr=reinterpret_cast<uint64_t>(operation);
+        }
+
+        /// Hands the queued submissions to the kernel now, for instance before closing a socket they refer to
+        void flush() {
+            std::lock_guard<std::mutex> lock(mutex);
+            submit();
+        }
+
+    private:
+        asio::io_service &io_service;
+        asio::posix::stream_descriptor event;
+        int fd=-1;
+
+        void *ring=MAP_FAILED;
+        size_t ring_size=0;
+        io_uring_sqe *sqes=static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t sqes_size=0;
+        unsigned *sq_head=nullptr, *sq_tail=nullptr, *sq_flags=nullptr;
+        unsigned sq_mask=0, sq_entries=0;
+        unsigned *cq_head=nullptr, *cq_tail=nullptr;
+        unsigned cq_mask=0;
+        io_uring_cqe *cqes=nullptr;
+
+        io_uring_buf_ring *buffer_ring=static_cast<io_uring_buf_ring*>(MAP_FAILED);
+        size_t buffer_ring_size=0;
+        char *buffer_memory=static_cast<char*>(MAP_FAILED);
+        size_t buffer_size;
+        unsigned buffer_count=0;
+        uint16_t buffer_tail=0;
+
+        /// Guards the submission ring and the flags below
+        std::mutex mutex;
+        unsigned tail=0;
+        /// Queued submissions not yet handed to the kernel
+        unsigned unsubmitted=0;
+        /// True while completions are handled, which submits the queued submissions afterwards
+        bool completing=false;
+        bool flush_posted=false;
+
+        static void throw_error(const char *what) {
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), what);
+        }
+
+        void release() {
+            if(buffer_memory!=MAP_FAILED)
+                munmap(buffer_memory, buffer_count*buffer_size);
+            if(buffer_ring!=MAP_FAILED)
+                munmap(buffer_ring, buffer_ring_size);
+            if(sqes!=MAP_FAILED)
+                munmap(sqes, sqes_size);
+            if(ring!=MAP_FAILED)
+                munmap(ring, ring_size);
+            if(fd>=0)
+                ::close(fd);
+            fd=-1;
+        }
+
+        int enter(unsigned to_submit, unsigned flags) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, nullptr, 0));
+        }
+
+        /// Returns a cleared submission, or nullptr if the ring is full and the kernel takes no more submissions until
+        /// completions have been handled. operation, if any, then completes with -EAGAIN. Called with mutex locked.
+        io_uring_sqe *next_sqe(uint8_t opcode, int socket, Operation *operation) {
+            //Make room by submitting if the ring is full
+            while(tail-__atomic_load_n(sq_head, __ATOMIC_ACQUIRE)>=sq_entries) {
+                auto queued=unsubmitted;
+                submit();
+                if(unsubmitted==queued) {
+                    if(operation) {
+                        asio::post(io_service, [operation] {
+                            operation->complete(-EAGAIN, 0);
+                        });
+                    }
+                    return nullptr;
+                }
+            }
+            auto &sqe=sqes[tail&sq_mask];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode=opcode;
+            sqe.fd=socket;
+            sqe.user_data=reinterpret_cast<uint64_t>(operation);
+            tail++;
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+            unsubmitted++;
+            if(!completing && !flush_posted) {
+                flush_posted=true;
+                auto self=shared_from_this();
+                asio::post(io_service, [self] {
+                    self->flush();
+                });
+            }
+            return &sqe;
+        }
+
+        /// Called with mutex locked
+        void submit() {
+            flush_posted=false;
+            while(unsubmitted>0) {
+                auto submitted=enter(unsubmitted, 0);
+                if(submitted>0)
+                    unsubmitted-=static_cast<unsigned>(submitted);
+                else if(submitted<0 && errno==EINTR)
+                    continue;
+                else if(submitted<0 && (errno==EAGAIN || errno==EBUSY)) {
+                    //Out of resources until completions have been handled. The eventfd wakes the io_service.
+                    if(!completing)
+                        post_flush();
+                    return;
+                }
+                else
+                    return;
+            }
+        }
+
+        void post_flush() {
+            if(flush_posted)
+                return;
+            flush_posted=true;
+            auto self=shared_from_this();
+            asio::post(io_service, [self] {
+                self->flush();
+            });
+        }
+
+        void wait_for_completions() {
+            auto self=shared_from_this();
+            event.async_wait(asio::posix::stream_descriptor::wait_read, [self](const boost::system::error_code &ec) {
+                if(!ec)
+                    self->handle_completions();
+            });
+        }
+
+        void handle_completions() {
+            uint64_t count;
+            while(::read(event.native_handle(), &count, sizeof(count))<0 && errno==EINTR) {
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completing=true;
+            }
+            while(true) {
+                auto head=*cq_head;
+                auto cq_end=__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+                if(head==cq_end) {
+                    //Completions that did not fit in the completion ring are moved to it by entering the kernel
+                    if(!(__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+                        break;
+                    enter(0, IORING_ENTER_GETEVENTS);
+                    continue;
+                }
+                for(;head!=cq_end;head++) {
+                    auto &cqe=cqes[head&cq_mask];
+                    auto operation=reinterpret_cast<Operation*>(cqe.user_data);
+                    auto result=cqe.res;
+                    auto flags=cqe.flags;
+                    __atomic_store_n(cq_head, head+1, __ATOMIC_RELEASE);
+                    if(operation)
+                        operation->complete(result, flags);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                submit();
+                completing=false;
+            }
+            wait_for_completions();
+        }
+    };
+
+    /// Stream socket whose reads and writes go through an IoUring, for Server<HTTP_URING>.
+    ///
+    /// Implements the parts of asio::ip::tcp::socket used by ServerBase, and serves as its own lowest layer.
+    /// Reading arms a multishot receive, which keeps receiving into the provided buffers; the data is copied to
+    /// the buffers of the pending read, or held until the next read. Receiving is cancelled while more than
+    /// max_held bytes are held, and resumed by the next read.
+    class UringSocket {
+    public:
+        typedef UringSocket lowest_layer_type;
+        typedef asio::io_service::executor_type executor_type;
+
+        static const size_t max_held=262144;
+        /// Buffers written at once by async_write_some()
+        static const size_t max_write_buffers=16;
+
+        explicit UringSocket(IoUring &ring, int fd=-1) : state(std::make_shared<State>(ring, fd)) {}
+        ~UringSocket() {
+            boost::system::error_code ec;
+            if(is_open()) {
+                shutdown(asio::socket_base::shutdown_both, ec);
+                close(ec);
+            }
+        }
+        UringSocket(const UringSocket&)=delete;
+        UringSocket &operator=(const UringSocket&)=delete;
+
+        executor_type get_executor() const noexcept {
+            return state->ring.get_io_service().get_executor();
+        }
+        lowest_layer_type &lowest_layer() {
+            return *this;
+        }
+        const lowest_layer_type &lowest_layer() const {
+            return *this;
+        }
+
+        int native_handle() const {
+            return state->fd;
+        }
+        bool is_open() const {
+            return state->fd>=0;
+        }
+        void native_non_blocking(bool mode, boost::system::error_code &ec) {
+            auto flags=fcntl(state->fd, F_GETFL, 0);
+            if(flags<0 || fcntl(state->fd, F_SETFL, mode ? flags | O_NONBLOCK : flags & ~O_NONBLOCK)<0)
+                ec=boost::system::error_code(errno, boost::system::system_category());
+            else
+                ec=boost::system::error_code();
+        }
+        template <class SettableSocketOption>
+        void set_option(const SettableSocketOption &option, boost::system::error_code &ec) {
+            auto protocol=asio::ip::tcp::v4();
+            if(setsockopt(state->fd, option.level(protocol), option.name(protocol), option.data(protocol),
+                          static_cast<socklen_t>(option.size(protocol)))<0)
+                ec=boost::system::error_code(errno, boost::system::system_category());
+            else
+                ec=boost::system::error_code();
+        }
+        asio::ip::tcp::endpoint remote_endpoint(boost::system::error_code &ec) const {
+            asio::ip::tcp::endpoint endpoint;
+            auto size=static_cast<socklen_t>(endpoint.capacity());
+            if(getpeername(state->fd, endpoint.data(), &size)<0) {
+                ec=boost::system::error_code(errno, boost::system::system_category());
+                return asio::ip::tcp::endpoint();
+            }
+            endpoint.resize(size);
+            ec=boost::system::error_code();
+            return endpoint;
+        }
+        void shutdown(asio::socket_base::shutdown_type what, boost::system::error_code &ec) {
+            if(::shutdown(state->fd, what)<0)
+                ec=boost::system::error_code(errno, boost::system::system_category());
+            else
+                ec=boost::system::error_code();
+        }
+        /// The queued submissions that refer to the socket are handed to the kernel first, since its descriptor
+        /// may be reused right away
+        void close(boost::system::error_code &ec) {
+            int fd;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                fd=state->fd;
+                state->fd=-1;
+                if(state->receiving && !state->cancelling) {
+                    state->cancelling=true;
+                    state->ring.cancel(state.get());
+                }
+            }
+            state->ring.flush();
+            if(fd<0 || ::close(fd)<0)
+                ec=fd<0 ? asio::error::bad_descriptor : boost::system::error_code(errno, boost::system::system_category());
+            else
+                ec=boost::system::error_code();
+        }
+
+        template <class MutableBufferSequence, class ReadHandler>
+        void async_read_some(const MutableBufferSequence &buffers, ReadHandler &&handler) {
+            auto operation=create<ReadOperation<MutableBufferSequence, typename std::decay<ReadHandler>::type>>(
+                handler, buffers, std::forward<ReadHandler>(handler));
+            state->read(operation);
+        }
+
+        template <class ConstBufferSequence, class WriteHandler>
+        void async_write_some(const ConstBufferSequence &buffers, WriteHandler &&handler) {
+            auto operation=create<WriteOperation<typename std::decay<WriteHandler>::type>>(
+                handler, std::forward<WriteHandler>(handler));
+            auto &message=operation->message;
+            for(auto it=asio::buffer_sequence_begin(buffers);it!=asio::buffer_sequence_end(buffers) &&
+                                                              message.msg_iovlen<max_write_buffers;++it) {
+                asio::const_buffer buffer(*it);
+                if(buffer.size()==0)
+                    continue;
+                operation->iovecs[message.msg_iovlen].iov_base=const_cast<void*>(buffer.data());
+                operation->iovecs[message.msg_iovlen].iov_len=buffer.size();
+                message.msg_iovlen++;
+            }
+            state->ring.send_message(state->fd, &message, operation);
+        }
+
+        template <class WaitHandler>
+        void async_wait(asio::socket_base::wait_type type, WaitHandler &&handler) {
+            auto operation=create<WaitOperation<typename std::decay<WaitHandler>::type>>(
+                handler, std::forward<WaitHandler>(handler));
+            state->ring.poll(state->fd, type==asio::socket_base::wait_write ? POLLOUT : type==asio::socket_base::wait_read ? POLLIN : POLLPRI,
+                             operation);
+        }
+
+    private:
+        /// Operation state allocated with the associated allocator of its handler
+        template <class Operation, class Handler>
+        using Allocator=typename std::allocator_traits<typename asio::associated_allocator<Handler>::type>::template rebind_alloc<Operation>;
+
+        template <class Operation, class Handler, class... Args>
+        static Operation *create(const Handler &handler, Args&&... args) {
+            Allocator<Operation, Handler> allocator(asio::get_associated_allocator(handler));
+            auto operation=std::allocator_traits<Allocator<Operation, Handler>>::allocate(allocator, 1);
+            try {
+                new(operation) Operation(std::forward<Args>(args)...);
+            }
+            catch(...) {
+                std::allocator_traits<Allocator<Operation, Handler>>::deallocate(allocator, operation, 1);
+                throw;
+            }
+            return operation;
+        }
+        /// Frees operation before the upcall, so that the handler can reuse its memory, and calls its handler
+        template <class Operation, class... Args>
+        static void upcall(Operation *operation, Args... args) {
+            auto handler=std::move(operation->handler);
+            Allocator<Operation, decltype(handler)> allocator(asio::get_associated_allocator(handler));
+            operation->~Operation();
+            std::allocator_traits<Allocator<Operation, decltype(handler)>>::deallocate(allocator, operation, 1);
+            handler(args...);
+        }
+
+        static boost::system::error_code error(int result) {
+            return result<0 ? boost::system::error_code(-result, boost::system::system_category()) : boost::system::error_code();
+        }
+
+        class ReadBase {
+        public:
+            /// Copies up to size bytes of data to the buffers of the read, and returns the number copied
+            virtual size_t copy(const char *data, size_t size)=0;
+            virtual void finish(const boost::system::error_code &ec, size_t size)=0;
+        protected:
+            ~ReadBase() {}
+        };
+
+        template <class MutableBufferSequence, class Handler>
+        class ReadOperation : public ReadBase {
+        public:
+            ReadOperation(const MutableBufferSequence &buffers, Handler handler) : buffers(buffers), handler(std::move(handler)) {}
+            size_t copy(const char *data, size_t size) override {
+                return asio::buffer_copy(buffers, asio::const_buffer(data, size));
+            }
+            void finish(const boost::system::error_code &ec, size_t size) override {
+                UringSocket::upcall(this, ec, size);
+            }
+            MutableBufferSequence buffers;
+            Handler handler;
+        };
+
+        template <class Handler>
+        class WriteOperation : public IoUring::Operation {
+        public:
+            explicit WriteOperation(Handler handler) : handler(std::move(handler)) {
+                std::memset(&message, 0, sizeof(message));
+                message.msg_iov=iovecs;
+            }
+            void complete(int result, unsigned /*flags*/) override {
+                UringSocket::upcall(this, error(result), result>0 ? static_cast<size_t>(result) : 0);
+            }
+            msghdr message;
+            iovec iovecs[max_write_buffers];
+            Handler handler;
+        };
+
+        template <class Handler>
+        class WaitOperation : public IoUring::Operation {
+        public:
+            explicit WaitOperation(Handler handler) : handler(std::move(handler)) {}
+            void complete(int result, unsigned /*flags*/) override {
+                UringSocket::upcall(this, error(result));
+            }
+            Handler handler;
+        };
+
+        /// The receiving side of the socket. Kept alive by the multishot receive while it is armed,
+        /// since its completions may arrive after the socket has been destroyed.
+        class State : public IoUring::Operation, public std::enable_shared_from_this<State> {
+        public:
+            State(IoUring &ring, int fd) : ring(ring), fd(fd) {}
+
+            IoUring &ring;
+            /// Guards the members below
+            std::mutex mutex;
+            int fd;
+            /// Received bytes not yet read, from held_start
+            std::vector<char> held;
+            size_t held_start=0;
+            ReadBase *reader=nullptr;
+            /// End of file or error, reported once the held bytes have been read
+            boost::system::error_code read_error;
+            bool receiving=false, cancelling=false;
+            std::shared_ptr<State> self;
+
+            void read(ReadBase *operation) {
+                boost::system::error_code ec;
+                size_t size=0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(held_start<held.size()) {
+                        size=operation->copy(&held[held_start], held.size()-held_start);
+                        held_start+=size;
+                        if(held_start==held.size()) {
+                            held.clear();
+                            held_start=0;
+                        }
+                    }
+                    else if(read_error)
+                        ec=read_error;
+                    else if(fd<0)
+                        ec=asio::error::bad_descriptor;
+                    else {
+                        reader=operation;
+                        if(!receiving)
+                            receive();
+                        return;
+                    }
+                }
+                //Not called from within async_read_some()
+                asio::post(ring.get_io_service(), [operation, ec, size] {
+                    operation->finish(ec, size);
+                });
+            }
+
+            /// Called with mutex locked
+            void receive() {
+                receiving=true;
+                self=shared_from_this();
+                ring.receive_multishot(fd, this);
+            }
+
+            void complete(int result, unsigned flags) override {
+                ReadBase *finished=nullptr;
+                boost::system::error_code ec;
+                size_t size=0;
+                std::shared_ptr<State> keep_alive;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(result>0) {
+                        auto id=static_cast<uint16_t>(flags>>IORING_CQE_BUFFER_SHIFT);
+                        auto data=ring.buffer(id);
+                        auto length=static_cast<size_t>(result);
+                        if(reader) {
+                            finished=reader;
+                            reader=nullptr;
+                            size=finished->copy(data, length);
+                        }
+                        if(size<length)
+                            held.insert(held.end(), data+size, data+length);
+                        ring.release_buffer(id);
+                        if(held.size()-held_start>max_held && (flags & IORING_CQE_F_MORE) && !cancelling) {
+                            cancelling=true;
+                            ring.cancel(this);
+                        }
+                    }
+                    else if(result==0)
+                        read_error=asio::error::eof;
+                    else if(result!=-ENOBUFS && result!=-ECANCELED)
+                        read_error=error(result);
+
+                    if(!(flags & IORING_CQE_F_MORE)) {
+                        receiving=false;
+                        cancelling=false;
+                        keep_alive=std::move(self);
+                        if(reader) {
+                            if(read_error || fd<0) {
+                                finished=reader;
+                                reader=nullptr;
+                                ec=read_error ? read_error : asio::error::operation_aborted;
+                            }
+                            else //Out of provided buffers, or cancelled while a read was issued
+                                receive();
+                        }
+                    }
+                }
+                if(finished)
+                    finished->finish(ec, size);
+            }
+        };
+
+        std::shared_ptr<State> state;
+    };
+}
+#endif	/* IO_URING_HPP */
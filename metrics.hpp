@@ -0,0 +1,258 @@
+#ifndef METRICS_HPP
+#define	METRICS_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace SimpleWeb {
+    /// HDR-style histogram of durations in nanoseconds. Each power of two is split into 16 linear sub-buckets,
+    /// so values are recorded with a relative error below 1/16 from 1 ns to about 18 minutes.
+    /// Written by one thread, read by any.
+    class Histogram {
+    public:
+        static const size_t sub_buckets=16;
+        /// Values from 2^octaves ns are recorded in the last bucket
+        static const size_t octaves=40;
+        static const size_t bucket_count=(octaves-3)*sub_buckets;
+
+        Histogram() {
+            for(auto &bucket: buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+        }
+
+        void record(uint64_t value) {
+            auto &bucket=buckets[index(value)];
+            bucket.store(bucket.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+            sum.store(sum.load(std::memory_order_relaxed)+value, std::memory_order_relaxed);
+        }
+
+        static size_t index(uint64_t value) {
+            if(value<sub_buckets)
+                return static_cast<size_t>(value);
+            size_t exponent=63-__builtin_clzll(value);
+            if(exponent>=octaves)
+                return bucket_count-1;
+            return (exponent-3)*sub_buckets+static_cast<size_t>((value>>(exponent-4))&(sub_buckets-1));
+        }
+        /// Smallest value recorded in bucket index
+        static uint64_t lower_bound(size_t index) {
+            if(index<sub_buckets)
+                return index;
+            auto exponent=index/sub_buckets+3;
+            return static_cast<uint64_t>(sub_buckets+index%sub_buckets)<<(exponent-4);
+        }
+
+        std::atomic<uint64_t> buckets[bucket_count];
+        std::atomic<uint64_t> sum;
+    };
+
+#ifndef WEB_SERVER_NO_METRICS
+    /// Counters and per stage latency histograms of a server.
+    ///
+    /// Each thread updates its own block of counters, with plain relaxed loads and stores instead of
+    /// read-modify-write operations, so that recording never contends. write() sums the blocks.
+    /// Compiled out, leaving empty inline functions, if WEB_SERVER_NO_METRICS is defined.
+    class Metrics {
+    public:
+        enum class Counter {connections_accepted, connections_closed, requests, keep_alive_requests, timeouts, bad_requests,
+                            shed_requests, bytes_received, bytes_sent, offload_queued, offload_started, offload_rejected,
+                            access_log_dropped, cache_hits, cache_misses, cache_coalesced, size};
+        /// read_header: from the first byte of a request to its complete header. parse: parsing the header.
+        /// route: finding the resource. read_content: receiving buffered content. handler: the resource function.
+        /// write: from the release of the response until it has been sent. request: from the first byte of a request
+        /// until its response has been sent. offload_wait: time spent by offloaded resource functions in the queue of
+        /// the OffloadExecutor.
+        enum class Stage {read_header, parse, route, read_content, handler, write, request, offload_wait, size};
+
+        typedef std::chrono::steady_clock::time_point TimePoint;
+        static TimePoint now() {
+            return std::chrono::steady_clock::now();
+        }
+
+        Metrics() : id(next_id()) {}
+        Metrics(const Metrics&)=delete;
+        Metrics &operator=(const Metrics&)=delete;
+
+        void add(Counter counter, uint64_t value=1) const {
+            auto &count=local().counters[static_cast<size_t>(counter)];
+            count.store(count.load(std::memory_order_relaxed)+value, std::memory_order_relaxed);
+        }
+        void record(Stage stage, TimePoint start, TimePoint end) const {
+            auto duration=std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
+            local().histograms[static_cast<size_t>(stage)].record(duration>0 ? static_cast<uint64_t>(duration) : 0);
+        }
+
+        uint64_t get(Counter counter) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t sum=0;
+            for(auto &thread: threads)
+                sum+=thread->counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+            return sum;
+        }
+
+        /// Writes the metrics in the Prometheus text format
+        void write(std::ostream &stream) const {
+            static const char *counter_names[]={"connections_accepted_total", "connections_closed_total", "requests_total",
+                                                "keep_alive_requests_total", "timeouts_total", "bad_requests_total",
+                                                "shed_requests_total", "received_bytes_total", "sent_bytes_total",
+                                                "offload_queued_total", "offload_started_total", "offload_rejected_total",
+                                                "access_log_dropped_total", "cache_hits_total", "cache_misses_total",
+                                                "cache_coalesced_total"};
+            static const char *stage_names[]={"read_header", "parse", "route", "read_content", "handler", "write", "request",
+                                              "offload_wait"};
+            static const double quantiles[]={0.5, 0.9, 0.99, 0.999};
+
+            uint64_t counters[static_cast<size_t>(Counter::size)]={};
+            std::vector<uint64_t> buckets(static_cast<size_t>(Stage::size)*Histogram::bucket_count);
+            std::vector<uint64_t> sums(static_cast<size_t>(Stage::size));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for(auto &thread: threads) {
+                    for(size_t c=0;c<static_cast<size_t>(Counter::size);c++)
+                        counters[c]+=thread->counters[c].load(std::memory_order_relaxed);
+                    for(size_t s=0;s<static_cast<size_t>(Stage::size);s++) {
+                        auto &histogram=thread->histograms[s];
+                        for(size_t b=0;b<Histogram::bucket_count;b++)
+                            buckets[s*Histogram::bucket_count+b]+=histogram.buckets[b].load(std::memory_order_relaxed);
+                        sums[s]+=histogram.sum.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            char line[256];
+            for(size_t c=0;c<static_cast<size_t>(Counter::size);c++) {
+                snprintf(line, sizeof(line), "# TYPE web_server_%s counter\nweb_server_%s %llu\n", counter_names[c],
+                         counter_names[c], static_cast<unsigned long long>(counters[c]));
+                stream << line;
+            }
+            snprintf(line, sizeof(line), "# TYPE web_server_connections_active gauge\nweb_server_connections_active %llu\n",
+                     static_cast<unsigned long long>(counters[0]-counters[1]));
+            stream << line;
+            //Offloaded tasks queued and not yet started. The blocks are summed one by one, so started may briefly lead.
+            auto queued=counters[static_cast<size_t>(Counter::offload_queued)];
+            auto started=counters[static_cast<size_t>(Counter::offload_started)];
+            snprintf(line, sizeof(line), "# TYPE web_server_offload_queue_depth gauge\nweb_server_offload_queue_depth %llu\n",
+                     static_cast<unsigned long long>(queued>started ? queued-started : 0));
+            stream << line;
+
+            //Cumulative buckets at each power of two from 1 us, in seconds
+            stream << "# TYPE web_server_stage_duration_seconds histogram\n";
+            for(size_t s=0;s<static_cast<size_t>(Stage::size);s++) {
+                auto stage_buckets=&buckets[s*Histogram::bucket_count];
+                uint64_t count=0;
+                size_t b=0;
+                for(size_t exponent=10;exponent<Histogram::octaves;exponent++) {
+                    for(;b<Histogram::bucket_count && Histogram::lower_bound(b)<(uint64_t(1)<<exponent);b++)
+                        count+=stage_buckets[b];
+                    snprintf(line, sizeof(line), "web_server_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                             stage_names[s], static_cast<double>(uint64_t(1)<<exponent)/1e9, static_cast<unsigned long long>(count));
+                    stream << line;
+                }
+                for(;b<Histogram::bucket_count;b++)
+                    count+=stage_buckets[b];
+                snprintf(line, sizeof(line), "web_server_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                         "web_server_stage_duration_seconds_sum{stage=\"%s\"} %.9g\n"
+                         "web_server_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                         stage_names[s], static_cast<unsigned long long>(count), stage_names[s], static_cast<double>(sums[s])/1e9,
+                         stage_names[s], static_cast<unsigned long long>(count));
+                stream << line;
+            }
+
+            //Quantiles from the full resolution of the histograms
+            stream << "# TYPE web_server_stage_duration_quantile_seconds gauge\n";
+            for(size_t s=0;s<static_cast<size_t>(Stage::size);s++) {
+                auto stage_buckets=&buckets[s*Histogram::bucket_count];
+                uint64_t count=0;
+                for(size_t b=0;b<Histogram::bucket_count;b++)
+                    count+=stage_buckets[b];
+                for(auto quantile: quantiles) {
+                    //Highest value of the bucket holding the quantile
+                    uint64_t rank=static_cast<uint64_t>(quantile*static_cast<double>(count)), seen=0, value=0;
+                    for(size_t b=0;b<Histogram::bucket_count && count>0;b++) {
+                        seen+=stage_buckets[b];
+                        if(seen>rank) {
+                            value=b+1<Histogram::bucket_count ? Histogram::lower_bound(b+1)-1 : Histogram::lower_bound(b);
+                            break;
+                        }
+                    }
+                    snprintf(line, sizeof(line), "web_server_stage_duration_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9g\n",
+                             stage_names[s], quantile, static_cast<double>(value)/1e9);
+                    stream << line;
+                }
+            }
+        }
+
+    private:
+        struct Thread {
+            Thread() : id(std::this_thread::get_id()) {
+                for(auto &counter: counters)
+                    counter.store(0, std::memory_order_relaxed);
+            }
+            std::thread::id id;
+            std::atomic<uint64_t> counters[static_cast<size_t>(Counter::size)];
+            Histogram histograms[static_cast<size_t>(Stage::size)];
+        };
+
+        /// Distinguishes instances, since a new one may reuse the address of a destroyed one
+        const uint64_t id;
+        mutable std::mutex mutex;
+        mutable std::vector<std::unique_ptr<Thread>> threads;
+
+        static uint64_t next_id() {
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+
+        /// The block of the calling thread. Looked up once, unless the thread records to several instances.
+        Thread &local() const {
+            thread_local uint64_t cached_id=0;
+            thread_local Thread *cached_thread=nullptr;
+            if(cached_id==id)
+                return *cached_thread;
+            std::lock_guard<std::mutex> lock(mutex);
+            auto thread_id=std::this_thread::get_id();
+            cached_thread=nullptr;
+            for(auto &thread: threads) {
+                if(thread->id==thread_id)
+                    cached_thread=thread.get();
+            }
+            if(!cached_thread) {
+                threads.emplace_back(new Thread());
+                cached_thread=threads.back().get();
+            }
+            cached_id=id;
+            return *cached_thread;
+        }
+    };
+#else
+    class Metrics {
+    public:
+        enum class Counter {connections_accepted, connections_closed, requests, keep_alive_requests, timeouts, bad_requests,
+                            shed_requests, bytes_received, bytes_sent, offload_queued, offload_started, offload_rejected,
+                            access_log_dropped, cache_hits, cache_misses, cache_coalesced, size};
+        enum class Stage {read_header, parse, route, read_content, handler, write, request, offload_wait, size};
+
+        struct TimePoint {};
+        static TimePoint now() {
+            return TimePoint();
+        }
+
+        void add(Counter, uint64_t=1) const {}
+        void record(Stage, TimePoint, TimePoint) const {}
+        uint64_t get(Counter) const {
+            return 0;
+        }
+        void write(std::ostream &stream) const {
+            stream << "# Metrics are compiled out\n";
+        }
+    };
+#endif
+}
+#endif	/* METRICS_HPP */
@@ -0,0 +1,131 @@
+#ifndef OFFLOAD_EXECUTOR_HPP
+#define	OFFLOAD_EXECUTOR_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SimpleWeb {
+    /// Pool of worker threads for tasks that would stall an io_service, such as blocking or CPU-heavy resource functions.
+    ///
+    /// Each worker has a bounded queue. post() spreads tasks over the queues round-robin, and a worker whose queue is
+    /// empty steals from the others before sleeping, so that one slow task does not hold back the tasks queued behind it.
+    /// Tasks are run in the order they were queued on each queue.
+    class OffloadExecutor {
+    public:
+        typedef std::function<void()> Task;
+
+        /// threads workers, each queueing at most queue_size tasks
+        OffloadExecutor(size_t threads, size_t queue_size) : queues(threads>0 ? threads : 1), queue_size(queue_size) {
+            for(size_t c=0;c<queues.size();c++)
+                queues[c]=std::unique_ptr<Queue>(new Queue());
+            for(size_t c=0;c<queues.size();c++) {
+                workers.emplace_back([this, c] {
+                    this->run(c);
+                });
+            }
+        }
+        /// Waits for the queued tasks to be run
+        ~OffloadExecutor() {
+            stop();
+            for(auto &worker: workers) {
+                if(worker.get_id()==std::this_thread::get_id())
+                    worker.detach();
+                else
+                    worker.join();
+            }
+        }
+        OffloadExecutor(const OffloadExecutor&)=delete;
+        OffloadExecutor &operator=(const OffloadExecutor&)=delete;
+
+        /// Queues task. Returns false, without queueing it, if every queue is full or the executor is stopped.
+        bool post(Task &&task) {
+            if(stopping.load(std::memory_order_relaxed))
+                return false;
+            auto first=next_queue.fetch_add(1, std::memory_order_relaxed);
+            for(size_t c=0;c<queues.size();c++) {
+                auto &queue=*queues[(first+c)%queues.size()];
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                if(queue.tasks.size()>=queue_size)
+                    continue;
+                queue.tasks.emplace_back(std::move(task));
+                pending.fetch_add(1);
+                lock.unlock();
+                //A worker that found nothing to do sleeps until notified
+                if(sleeping.load()>0) {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    wake.notify_one();
+                }
+                return true;
+            }
+            return false;
+        }
+
+        /// Number of tasks queued and not yet started
+        size_t depth() const {
+            return pending.load(std::memory_order_relaxed);
+        }
+
+        /// Rejects further tasks. The workers exit once the queued tasks have been run.
+        void stop() {
+            stopping.store(true);
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            wake.notify_all();
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        std::vector<std::unique_ptr<Queue>> queues;
+        size_t queue_size;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> next_queue{0};
+        std::atomic<size_t> pending{0};
+        std::atomic<size_t> sleeping{0};
+        std::atomic<bool> stopping{false};
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+
+        /// Takes the oldest task of queue index, or of another queue
+        bool take(size_t index, Task &task) {
+            for(size_t c=0;c<queues.size();c++) {
+                auto &queue=*queues[(index+c)%queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if(!queue.tasks.empty()) {
+                    task=std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                    pending.fetch_sub(1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void run(size_t index) {
+            Task task;
+            while(true) {
+                if(take(index, task)) {
+                    task();
+                    task=nullptr;
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleeping.fetch_add(1);
+                wake.wait(lock, [this] {
+                    return pending.load()>0 || stopping.load();
+                });
+                sleeping.fetch_sub(1);
+                if(pending.load()==0 && stopping.load())
+                    return;
+            }
+        }
+    };
+}
+#endif	/* OFFLOAD_EXECUTOR_HPP */
@@ -0,0 +1,195 @@
+#ifndef REQUEST_PARSER_HPP
+#define	REQUEST_PARSER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <boost/utility/string_view.hpp>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace SimpleWeb {
+    /// Incremental HTTP request header parser working directly on the receive buffer.
+    ///
+    /// parse() is called with the complete buffered data each time more has been received, and resumes at
+    /// the first line it has not yet seen. The request line and headers are returned as slices of that buffer,
+    /// valid until the buffer is modified. Nothing is allocated while parsing.
+    class RequestParser {
+    public:
+        enum class Result {complete, incomplete, bad_request, too_large};
+
+        struct Header {
+            boost::string_view name, value;
+        };
+
+        /// Upper bound for max_headers
+        static const size_t header_capacity=128;
+
+        /// Maximum size of the request line and headers, including the empty line
+        size_t max_header_size=65536;
+        /// Maximum number of headers
+        size_t max_headers=100;
+
+        /// Prepare for a new request
+        void reset() {
+            position=0;
+            scanned=0;
+            line_count=0;
+            num_headers=0;
+            length=0;
+        }
+
+        /// Parse data[0, size), the bytes received for this request so far.
+        Result parse(const char *data, size_t size) {
+            base=data;
+            while(true) {
+                auto line_start=data+position;
+                //Continue scanning where the previous call stopped within this line
+                auto line_end=find(data+std::max(position, scanned), data+size, '\n', '\n', '\n');
+                if(!line_end) {
+                    scanned=size;
+                    if(size>max_header_size)
+                        return Result::too_large;
+                    return Result::incomplete;
+                }
+                if(static_cast<size_t>(line_end-data)>=max_header_size)
+                    return Result::too_large;
+                position=static_cast<size_t>(line_end-data)+1;
+
+                //Tolerate bare LF line endings
+                auto content_end=line_end>line_start && *(line_end-1)=='\r' ? line_end-1 : line_end;
+                if(line_count++==0) {
+                    if(!parse_request_line(line_start, content_end))
+                        return Result::bad_request;
+                }
+                else if(content_end==line_start) {
+                    length=position;
+                    return Result::complete;
+                }
+                else if(num_headers==max_headers || num_headers==header_capacity)
+                    return Result::too_large;
+                else if(!parse_header_line(line_start, content_end))
+                    return Result::bad_request;
+            }
+        }
+
+        /// Number of bytes of the request line and headers, including the empty line, once parse() returned complete
+        size_t header_length() const {
+            return length;
+        }
+
+        boost::string_view method() const {
+            return slice(method_slice);
+        }
+        boost::string_view path() const {
+            return slice(path_slice);
+        }
+        boost::string_view http_version() const {
+            return slice(http_version_slice);
+        }
+        size_t headers_size() const {
+            return num_headers;
+        }
+        Header header(size_t index) const {
+            return {slice(headers[index].name), slice(headers[index].value)};
+        }
+
+        /// Returns the first occurrence of c1, c2 or c3 in [begin, end), or nullptr if there is none.
+        static const char *find(const char *begin, const char *end, char c1, char c2, char c3) {
+#if defined(__AVX2__)
+            auto v1=_mm256_set1_epi8(c1), v2=_mm256_set1_epi8(c2), v3=_mm256_set1_epi8(c3);
+            for(;end-begin>=32;begin+=32) {
+                auto chunk=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+                auto matches=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, v1), _mm256_cmpeq_epi8(chunk, v2)),
+                                             _mm256_cmpeq_epi8(chunk, v3));
+                auto mask=static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+                if(mask)
+                    return begin+__builtin_ctz(mask);
+            }
+#elif defined(__SSE4_2__)
+            const char set[16]={c1, c2, c3};
+            auto needle=_mm_loadu_si128(reinterpret_cast<const __m128i*>(set));
+            for(;end-begin>=16;begin+=16) {
+                auto chunk=_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+                auto index=_mm_cmpestri(needle, 3, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+                if(index<16)
+                    return begin+index;
+            }
+#elif defined(__SSE2__)
+            auto v1=_mm_set1_epi8(c1), v2=_mm_set1_epi8(c2), v3=_mm_set1_epi8(c3);
+            for(;end-begin>=16;begin+=16) {
+                auto chunk=_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+                auto matches=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)), _mm_cmpeq_epi8(chunk, v3));
+                auto mask=static_cast<uint32_t>(_mm_movemask_epi8(matches));
+                if(mask)
+                    return begin+__builtin_ctz(mask);
+            }
+#endif
+            for(;begin<end;++begin) {
+                if(*begin==c1 || *begin==c2 || *begin==c3)
+                    return begin;
+            }
+            return nullptr;
+        }
+
+    private:
+        /// Offsets into the buffer, since it may move between calls to parse()
+        struct Slice {
+            uint32_t offset, size;
+        };
+
+        const char *base=nullptr;
+        size_t position=0;
+        size_t scanned=0;
+        size_t line_count=0;
+        size_t length=0;
+        Slice method_slice={0, 0}, path_slice={0, 0}, http_version_slice={0, 0};
+        struct {
+            Slice name, value;
+        } headers[header_capacity];
+        size_t num_headers=0;
+
+        boost::string_view slice(const Slice &slice) const {
+            return boost::string_view(base+slice.offset, slice.size);
+        }
+        Slice make_slice(const char *begin, const char *end) const {
+            return {static_cast<uint32_t>(begin-base), static_cast<uint32_t>(end-begin)};
+        }
+
+        bool parse_request_line(const char *begin, const char *end) {
+            auto method_end=find(begin, end, ' ', ' ', ' ');
+            if(!method_end || method_end==begin)
+                return false;
+            auto path_end=find(method_end+1, end, ' ', ' ', ' ');
+            if(!path_end || path_end==method_end+1)
+                return false;
+            auto protocol_end=find(path_end+1, end, '/', '/', '/');
+            if(!protocol_end || protocol_end-path_end-1!=4 || std::memcmp(path_end+1, "HTTP", 4)!=0)
+                return false;
+            method_slice=make_slice(begin, method_end);
+            path_slice=make_slice(method_end+1, path_end);
+            http_version_slice=make_slice(protocol_end+1, end);
+            return true;
+        }
+
+        bool parse_header_line(const char *begin, const char *end) {
+            auto name_end=find(begin, end, ':', ':', ':');
+            if(!name_end || name_end==begin)
+                return false;
+            auto value_begin=name_end+1;
+            while(value_begin<end && (*value_begin==' ' || *value_begin=='\t'))
+                ++value_begin;
+            auto value_end=end;
+            while(value_end>value_begin && (*(value_end-1)==' ' || *(value_end-1)=='\t'))
+                --value_end;
+            auto &header=headers[num_headers++];
+            header.name=make_slice(begin, name_end);
+            header.value=make_slice(value_begin, value_end);
+            return true;
+        }
+    };
+}
+#endif	/* REQUEST_PARSER_HPP */
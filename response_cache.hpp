@@ -0,0 +1,205 @@
+#ifndef RESPONSE_CACHE_HPP
+#define	RESPONSE_CACHE_HPP
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SimpleWeb {
+    /// In-process cache of serialized responses, with a time to live per entry and a memory budget.
+    ///
+    /// The keys are spread over shards, each with its own lock, LRU list and share of the budget. A shard evicts its
+    /// least recently used entries once its share is exceeded. Lookups that miss are coalesced: the first one fills
+    /// the entry, and the others wait for it instead of producing the same response again. An expired entry is
+    /// refilled the same way, so that a popular key expiring does not release a burst of identical work.
+    class ResponseCache {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /// A serialized response, header included. Shared by the cache and the responses sending it.
+        struct Entry {
+            std::string data;
+            Clock::time_point expires;
+        };
+        /// Called with the entry once it has been filled, or with nullptr if filling it was abandoned.
+        /// Called from the thread that filled or abandoned it, without lock held.
+        typedef std::function<void(const std::shared_ptr<const Entry>&)> Waiter;
+
+        enum class Lookup {
+            /// entry is set
+            hit,
+            /// The waiter has been queued for the entry being filled
+            wait,
+            /// The caller fills the entry with fill(), or gives up with abandon()
+            fill
+        };
+
+        /// memory_budget bytes spread over shards
+        ResponseCache(size_t memory_budget, size_t shards) : shards(shards>0 ? shards : 1) {
+            for(auto &shard: this->shards) {
+                shard=std::unique_ptr<Shard>(new Shard());
+                shard->budget=memory_budget/this->shards.size();
+            }
+        }
+        ResponseCache(const ResponseCache&)=delete;
+        ResponseCache &operator=(const ResponseCache&)=delete;
+
+        /// Looks up key. make_waiter() is only called, with the shard locked, if the entry is being filled.
+        template <class MakeWaiter>
+        Lookup find(const std::string &key, std::shared_ptr<const Entry> &entry, MakeWaiter &&make_waiter) {
+            auto &shard=shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it=shard.slots.find(key);
+            if(it==shard.slots.end()) {
+                it=shard.slots.emplace(key, Slot()).first;
+                it->second.filling=true;
+                return Lookup::fill;
+            }
+            auto &slot=it->second;
+            if(slot.filling) {
+                slot.waiters.emplace_back(make_waiter());
+                return Lookup::wait;
+            }
+            if(slot.entry->expires<=Clock::now()) {
+                slot.filling=true;
+                return Lookup::fill;
+            }
+            if(slot.lru!=shard.lru.begin())
+                shard.lru.splice(shard.lru.begin(), shard.lru, slot.lru);
+            entry=slot.entry;
+            return Lookup::hit;
+        }
+
+        /// Stores data for key, after a find() that returned Lookup::fill, and hands it to the waiters.
+        /// The waiters receive it even if it does not fit in the memory budget of its shard.
+        void fill(const std::string &key, std::string &&data, Clock::duration ttl) {
+            auto entry=std::make_shared<Entry>();
+            entry->data=std::move(data);
+            entry->expires=Clock::now()+ttl;
+            std::vector<Waiter> waiters;
+            {
+                auto &shard=shard_of(key);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto it=shard.slots.find(key);
+                if(it==shard.slots.end())
+                    return;
+                auto &slot=it->second;
+                waiters=std::move(slot.waiters);
+                slot.waiters.clear();
+                slot.filling=false;
+                auto size=entry_size(key, *entry);
+                if(size>shard.budget) {
+                    remove(shard, it);
+                }
+                else {
+                    if(slot.entry) {
+                        shard.used-=entry_size(key, *slot.entry);
+                        shard.lru.splice(shard.lru.begin(), shard.lru, slot.lru);
+                    }
+                    else
+                        slot.lru=shard.lru.insert(shard.lru.begin(), &it->first);
+                    slot.entry=entry;
+                    shard.used+=size;
+                    evict(shard);
+                }
+            }
+            for(auto &waiter: waiters)
+                waiter(entry);
+        }
+
+        /// Gives up filling key, after a find() that returned Lookup::fill. An expired entry is kept until the next
+        /// fill, and the waiters are called with nullptr.
+        void abandon(const std::string &key) {
+            std::vector<Waiter> waiters;
+            {
+                auto &shard=shard_of(key);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto it=shard.slots.find(key);
+                if(it==shard.slots.end())
+                    return;
+                waiters=std::move(it->second.waiters);
+                it->second.waiters.clear();
+                it->second.filling=false;
+                if(!it->second.entry)
+                    shard.slots.erase(it);
+            }
+            for(auto &waiter: waiters)
+                waiter(nullptr);
+        }
+
+        /// Removes the entries that are not being filled
+        void clear() {
+            for(auto &shard: shards) {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                for(auto it=shard->slots.begin();it!=shard->slots.end();) {
+                    auto next=std::next(it);
+                    if(!it->second.filling)
+                        remove(*shard, it);
+                    it=next;
+                }
+            }
+        }
+
+        /// Bytes used by the cached entries, with their keys
+        size_t size() const {
+            size_t sum=0;
+            for(auto &shard: shards) {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                sum+=shard->used;
+            }
+            return sum;
+        }
+
+    private:
+        struct Slot {
+            /// nullptr while filled for the first time
+            std::shared_ptr<const Entry> entry;
+            bool filling=false;
+            std::vector<Waiter> waiters;
+            /// Position in the LRU list of the shard, if entry is set
+            std::list<const std::string*>::iterator lru;
+        };
+        typedef std::unordered_map<std::string, Slot> Slots;
+        struct Shard {
+            std::mutex mutex;
+            Slots slots;
+            /// Keys of the slots with an entry, most recently used first
+            std::list<const std::string*> lru;
+            size_t budget=0, used=0;
+        };
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        Shard &shard_of(const std::string &key) {
+            return *shards[std::hash<std::string>()(key)%shards.size()];
+        }
+
+        /// Includes an estimate of the bookkeeping
+        static size_t entry_size(const std::string &key, const Entry &entry) {
+            return key.size()+entry.data.size()+sizeof(Entry)+sizeof(Slot)+64;
+        }
+
+        void remove(Shard &shard, Slots::iterator it) {
+            if(it->second.entry) {
+                shard.used-=entry_size(it->first, *it->second.entry);
+                shard.lru.erase(it->second.lru);
+            }
+            shard.slots.erase(it);
+        }
+
+        /// Evicts the least recently used entries not being refilled until the shard fits its budget
+        void evict(Shard &shard) {
+            auto it=shard.lru.end();
+            while(shard.used>shard.budget && it!=shard.lru.begin()) {
+                auto slot=shard.slots.find(**--it);
+                if(!slot->second.filling)
+                    it=std::next(it), remove(shard, slot);
+            }
+        }
+    };
+}
+#endif	/* RESPONSE_CACHE_HPP */
@@ -0,0 +1,113 @@
+#ifndef RESPONSE_FORMAT_HPP
+#define	RESPONSE_FORMAT_HPP
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+
+namespace SimpleWeb {
+    /// Returns the preformatted status line of code, for instance "HTTP/1.1 200 OK\r\n".
+    /// Codes without a known reason phrase get an empty one. Throws std::invalid_argument outside 100-599.
+    inline boost::string_view status_line(unsigned code) {
+        static const std::vector<std::string> lines=[] {
+            static const std::pair<unsigned, const char*> reasons[]={
+                {100, "Continue"}, {101, "Switching Protocols"},
+                {200, "OK"}, {201, "Created"}, {202, "Accepted"}, {203, "Non-Authoritative Information"}, {204, "No Content"},
+                {205, "Reset Content"}, {206, "Partial Content"},
+                {300, "Multiple Choices"}, {301, "Moved Permanently"}, {302, "Found"}, {303, "See Other"}, {304, "Not Modified"},
+                {307, "Temporary Redirect"}, {308, "Permanent Redirect"},
+                {400, "Bad Request"}, {401, "Unauthorized"}, {403, "Forbidden"}, {404, "Not Found"}, {405, "Method Not Allowed"},
+                {406, "Not Acceptable"}, {408, "Request Timeout"}, {409, "Conflict"}, {410, "Gone"}, {411, "Length Required"},
+                {412, "Precondition Failed"}, {413, "Payload Too Large"}, {414, "URI Too Long"}, {415, "Unsupported Media Type"},
+                {416, "Range Not Satisfiable"}, {417, "Expectation Failed"}, {426, "Upgrade Required"}, {428, "Precondition Required"},
+                {429, "Too Many Requests"}, {431, "Request Header Fields Too Large"},
+                {500, "Internal Server Error"}, {501, "Not Implemented"}, {502, "Bad Gateway"}, {503, "Service Unavailable"},
+                {504, "Gateway Timeout"}, {505, "HTTP Version Not Supported"}};
+            std::vector<std::string> lines(600);
+            for(unsigned code=100;code<600;code++)
+                lines[code]="HTTP/1.1 "+std::to_string(code)+" \r\n";
+            for(auto &reason: reasons)
+                lines[reason.first]="HTTP/1.1 "+std::to_string(reason.first)+" "+reason.second+"\r\n";
+            return lines;
+        }();
+        if(code<100 || code>=600)
+            throw std::invalid_argument("invalid status code: "+std::to_string(code));
+        return lines[code];
+    }
+
+    /// Writes value in decimal to buffer, which must hold at least 20 characters, and returns the number written.
+    /// Unlike operator<<, this does not consult the locale.
+    inline size_t format_decimal(uint64_t value, char *buffer) {
+        char reversed[20];
+        size_t length=0;
+        do {
+            reversed[length++]=static_cast<char>('0'+value%10);
+            value/=10;
+        } while(value>0);
+        for(size_t c=0;c<length;c++)
+            buffer[c]=reversed[length-1-c];
+        return length;
+    }
+
+    /// Parses text made of one or more ASCII digits, without sign or white space, into value.
+    /// Returns false for any other text, or if the number does not fit in value.
+    inline bool parse_decimal(boost::string_view text, unsigned long long &value) {
+        if(text.empty())
+            return false;
+        unsigned long long result=0;
+        for(auto c: text) {
+            if(c<'0' || c>'9')
+                return false;
+            auto digit=static_cast<unsigned long long>(c-'0');
+            if(result>(std::numeric_limits<unsigned long long>::max()-digit)/10)
+                return false;
+            result=result*10+digit;
+        }
+        value=result;
+        return true;
+    }
+
+    /// Returns the Date header line for the current second, for instance "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n".
+    /// Formatted once per second per thread, and valid until the next call on the same thread.
+    inline boost::string_view date_header() {
+        thread_local time_t formatted_time=-1;
+        thread_local char line[40];
+        auto now=time(nullptr);
+        if(now!=formatted_time) {
+            //Formatted by hand, since strftime depends on the locale
+            static const char days[]="SunMonTueWedThuFriSat";
+            static const char months[]="JanFebMarAprMayJunJulAugSepOctNovDec";
+            struct tm tm;
+            gmtime_r(&now, &tm);
+            auto two_digits=[](char *p, int value) {
+                p[0]=static_cast<char>('0'+value/10);
+                p[1]=static_cast<char>('0'+value%10);
+            };
+            std::memcpy(line, "Date: ", 6);
+            std::memcpy(line+6, days+3*tm.tm_wday, 3);
+            std::memcpy(line+9, ", ", 2);
+            two_digits(line+11, tm.tm_mday);
+            line[13]=' ';
+            std::memcpy(line+14, months+3*tm.tm_mon, 3);
+            line[17]=' ';
+            auto year=tm.tm_year+1900;
+            two_digits(line+18, year/100);
+            two_digits(line+20, year%100);
+            line[22]=' ';
+            two_digits(line+23, tm.tm_hour);
+            line[25]=':';
+            two_digits(line+26, tm.tm_min);
+            line[28]=':';
+            two_digits(line+29, tm.tm_sec);
+            std::memcpy(line+31, " GMT\r\n", 6);
+            formatted_time=now;
+        }
+        return boost::string_view(line, 37);
+    }
+}
+#endif	/* RESPONSE_FORMAT_HPP */
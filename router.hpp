@@ -0,0 +1,237 @@
+#ifndef ROUTER_HPP
+#define	ROUTER_HPP
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+
+namespace SimpleWeb {
+    /// Parameters captured from the request path by a route pattern, as slices of the request path.
+    class PathParameters {
+    public:
+        static const size_t capacity=16;
+
+        size_t size() const {
+            return count;
+        }
+        const std::pair<boost::string_view, boost::string_view> &operator[](size_t index) const {
+            return parameters[index];
+        }
+        /// Returns the value of parameter name, or an empty string_view if there is none.
+        /// The value of a trailing * is found under the name "*".
+        boost::string_view get(boost::string_view name) const {
+            for(size_t c=0;c<count;c++) {
+                if(parameters[c].first==name)
+                    return parameters[c].second;
+            }
+            return boost::string_view();
+        }
+
+        void clear() {
+            count=0;
+        }
+        bool push(boost::string_view name, boost::string_view value) {
+            if(count==capacity)
+                return false;
+            parameters[count++]=std::make_pair(name, value);
+            return true;
+        }
+        void pop() {
+            --count;
+        }
+    private:
+        std::pair<boost::string_view, boost::string_view> parameters[capacity];
+        size_t count=0;
+    };
+
+    /// Maps (method, path pattern) pairs to values, for instance resource functions.
+    ///
+    /// Patterns are made of static text, {name} segments that match up to the next '/',
+    /// and an optional trailing * that matches the rest of the path, as in /api/users/{id} or /static/*.
+    /// Static text is preferred over parameters, and parameters over *. The patterns are stored in a
+    /// radix tree that is frozen by compile(). find() does not allocate. It backtracks to the next alternative
+    /// when the preferred branch does not match the rest of the path, but visits each node at most once. Its time
+    /// is therefore proportional to the path length when patterns do not overlap, and to the total length of the
+    /// patterns at worst.
+    template <class Value>
+    class Router {
+    public:
+        enum class Result {found, method_not_allowed, not_found};
+
+        void add(const std::string &method, const std::string &pattern, const Value &value) {
+            if(frozen)
+                throw std::logic_error("Router: routes cannot be added after compile()");
+            if(pattern.empty() || pattern[0]!='/')
+                throw std::invalid_argument("Router: pattern must start with '/': "+pattern);
+            auto node=&root;
+            size_t position=0;
+            while(position<pattern.size()) {
+                if(pattern[position]=='{') {
+                    auto end=pattern.find('}', position);
+                    if(end==std::string::npos || end==position+1 || (end+1<pattern.size() && pattern[end+1]!='/'))
+                        throw std::invalid_argument("Router: malformed parameter in pattern: "+pattern);
+                    auto name=pattern.substr(position+1, end-position-1);
+                    if(!node->parameter_child) {
+                        node->parameter_child=std::unique_ptr<Node>(new Node());
+                        node->parameter_child->parameter_name=name;
+                    }
+                    else if(node->parameter_child->parameter_name!=name)
+                        throw std::invalid_argument("Router: conflicting parameter name in pattern: "+pattern);
+                    node=node->parameter_child.get();
+                    position=end+1;
+                }
+                else if(pattern[position]=='*') {
+                    if(position+1!=pattern.size())
+                        throw std::invalid_argument("Router: * must end the pattern: "+pattern);
+                    if(!node->wildcard_child)
+                        node->wildcard_child=std::unique_ptr<Node>(new Node());
+                    node=node->wildcard_child.get();
+                    position++;
+                }
+                else {
+                    auto end=pattern.find_first_of("{*", position);
+                    if(end==std::string::npos)
+                        end=pattern.size();
+                    node=insert_static(node, pattern.substr(position, end-position));
+                    position=end;
+                }
+            }
+            for(auto &endpoint: node->endpoints) {
+                if(endpoint.first==method)
+                    throw std::invalid_argument("Router: duplicate route: "+method+" "+pattern);
+            }
+            node->endpoints.emplace_back(method, value);
+        }
+
+        /// Freezes the routes. Called by the server when it starts.
+        void compile() {
+            if(!frozen) {
+                compile(root);
+                frozen=true;
+            }
+        }
+
+        bool empty() const {
+            return root.children.empty() && root.endpoints.empty() && !root.parameter_child && !root.wildcard_child;
+        }
+
+        /// Looks up path, ignoring any query string. On found, value is set and parameters holds the captures.
+        /// On method_not_allowed, allow is set to the comma separated methods that the path does accept.
+        Result find(boost::string_view method, boost::string_view path, const Value *&value, PathParameters &parameters,
+                    const std::string *&allow) const {
+            auto query=path.find('?');
+            if(query!=boost::string_view::npos)
+                path=path.substr(0, query);
+            parameters.clear();
+            auto node=match(root, path, 0, parameters);
+            if(!node)
+                return Result::not_found;
+            for(auto &endpoint: node->endpoints) {
+                if(endpoint.first==method) {
+                    value=&endpoint.second;
+                    return Result::found;
+                }
+            }
+            allow=&node->allow;
+            return Result::method_not_allowed;
+        }
+
+    private:
+        struct Node {
+            std::string prefix;
+            /// First character of each static child, in the same order as children
+            std::string indices;
+            std::vector<std::unique_ptr<Node>> children;
+            std::unique_ptr<Node> parameter_child;
+            std::string parameter_name;
+            std::unique_ptr<Node> wildcard_child;
+            std::vector<std::pair<std::string, Value>> endpoints;
+            std::string allow;
+        };
+
+        Node root;
+        bool frozen=false;
+
+        /// Inserts static text below node, splitting edges as needed, and returns the node it ends at
+        static Node *insert_static(Node *node, std::string text) {
+            while(!text.empty()) {
+                auto it=std::find_if(node->children.begin(), node->children.end(), [&text](const std::unique_ptr<Node> &child) {
+                    return child->prefix[0]==text[0];
+                });
+                if(it==node->children.end()) {
+                    std::unique_ptr<Node> child(new Node());
+                    child->prefix=text;
+                    node->children.emplace_back(std::move(child));
+                    return node->children.back().get();
+                }
+                auto child=it->get();
+                size_t common=0;
+                while(common<text.size() && common<child->prefix.size() && text[common]==child->prefix[common])
+                    common++;
+                if(common<child->prefix.size()) {
+                    //Split the edge: the new node takes the common prefix and the old child becomes its child
+                    std::unique_ptr<Node> split(new Node());
+                    split->prefix=child->prefix.substr(0, common);
+                    it->swap(split);
+                    split->prefix.erase(0, common);
+                    (*it)->children.emplace_back(std::move(split));
+                    child=it->get();
+                }
+                node=child;
+                text.erase(0, common);
+            }
+            return node;
+        }
+
+        static void compile(Node &node) {
+            std::sort(node.children.begin(), node.children.end(), [](const std::unique_ptr<Node> &a, const std::unique_ptr<Node> &b) {
+                return a->prefix<b->prefix;
+            });
+            node.indices.clear();
+            for(auto &child: node.children) {
+                node.indices+=child->prefix[0];
+                compile(*child);
+            }
+            node.allow.clear();
+            for(auto &endpoint: node.endpoints)
+                node.allow+=(node.allow.empty() ? "" : ", ")+endpoint.first;
+            if(node.parameter_child)
+                compile(*node.parameter_child);
+            if(node.wildcard_child)
+                compile(*node.wildcard_child);
+        }
+
+        /// Matches path[position, end) below node, returning the node with endpoints it ends at, if any
+        static const Node *match(const Node &node, boost::string_view path, size_t position, PathParameters &parameters) {
+            if(position==path.size() && !node.endpoints.empty())
+                return &node;
+            if(position<path.size()) {
+                auto index=node.indices.find(path[position]);
+                if(index!=std::string::npos) {
+                    auto &child=*node.children[index];
+                    if(path.substr(position, child.prefix.size())==child.prefix) {
+                        if(auto result=match(child, path, position+child.prefix.size(), parameters))
+                            return result;
+                    }
+                }
+                if(node.parameter_child) {
+                    auto end=path.find('/', position);
+                    if(end==boost::string_view::npos)
+                        end=path.size();
+                    if(end>position && parameters.push(node.parameter_child->parameter_name, path.substr(position, end-position))) {
+                        if(auto result=match(*node.parameter_child, path, end, parameters))
+                            return result;
+                        parameters.pop();
+                    }
+                }
+            }
+            if(node.wildcard_child && !node.wildcard_child->endpoints.empty() && parameters.push("*", path.substr(position)))
+                return node.wildcard_child.get();
+            return nullptr;
+        }
+    };
+}
+#endif	/* ROUTER_HPP */
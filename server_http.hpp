@@ -1,14 +1,36 @@
 #ifndef SERVER_HTTP_HPP
 #define	SERVER_HTTP_HPP
+#include <atomic>
 #include <map>
 #include <unordered_map>
 #include <thread>
 #include <functional>
+#include <mutex>
+#include <limits>
+#include <initializer_list>
+#include <utility>
 #include <iostream>
 #include <sstream>
 #include <boost/asio.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/functional/hash.hpp>
+#include <cstring>
+#include "request_parser.hpp"
+#include "chunked_encoding.hpp"
+#include "response_format.hpp"
+#include "router.hpp"
+#include "timer_wheel.hpp"
+#include "handler_allocator.hpp"
+#include "metrics.hpp"
+#include "offload_executor.hpp"
+#include "access_log.hpp"
+#include "response_cache.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 namespace SimpleWeb {
     namespace asio = boost::asio;
     using error_code = boost::system::error_code;
@@ -55,27 +77,324 @@ namespace SimpleWeb {
 #endif
 
 namespace SimpleWeb {
+    /// Read-only file descriptor to be sent with ServerBase::send_file().
+    class File {
+    public:
+        File(const std::string &path) {
+            fd=::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd>=0) {
+                struct stat st;
+                if(fstat(fd, &st)==0 && S_ISREG(st.st_mode)) {
+                    file_size=static_cast<size_t>(st.st_size);
+                    modified=st.st_mtime;
+                }
+                else {
+                    ::close(fd);
+                    fd=-1;
+                }
+            }
+        }
+        ~File() {
+            if(fd>=0)
+                ::close(fd);
+        }
+        File(const File&)=delete;
+        File &operator=(const File&)=delete;
+
+        /// False if the path could not be opened or is not a regular file
+        explicit operator bool() const {
+            return fd>=0;
+        }
+        int native_handle() const {
+            return fd;
+        }
+        size_t size() const {
+            return file_size;
+        }
+        time_t last_modified() const {
+            return modified;
+        }
+    private:
+        int fd;
+        size_t file_size=0;
+        time_t modified=0;
+    };
+
     template <class socket_type>
     class Server;
+
+    /// Return type of resource functions written as coroutines, defined in coroutine_handler.hpp
+    class CoroutineHandler;
     
     template <class socket_type>
     class ServerBase {
+        friend class CoroutineHandler;
     public:
     //virtual functionis an inheritable and overridable function for which dynamic dispatch is facilitated
         virtual ~ServerBase() {}
 
+        class Request;
+        class Response;
+        struct CachePolicy;
+
+        typedef std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>,
+                                   std::shared_ptr<typename ServerBase<socket_type>::Request>)> ResourceFunction;
+
+        /// A socket with the timeout of the operation in progress on it, and the buffers and memory
+        /// that are reused by the requests on it
+        class Connection : public TimerWheel::Entry {
+            friend class ServerBase<socket_type>;
+            friend class Server<socket_type>;
+            friend class CoroutineHandler;
+        public:
+            template<class... Args>
+            Connection(const std::shared_ptr<TimerWheel> &timer_wheel, Args&&... args) :
+                    socket(std::forward<Args>(args)...), timer_wheel(timer_wheel) {}
+            ~Connection() {
+                timer_wheel->cancel(*this);
+                if(server)
+                    server->connection_closed(*this);
+            }
+
+            socket_type socket;
+
+            /// Closes the connection unless the timeout is set again or cancelled within seconds. 0 means no timeout.
+            void set_timeout(long seconds) {
+                if(seconds==0)
+                    cancel_timeout();
+                else
+                    timer_wheel->schedule(*this, std::chrono::seconds(seconds));
+            }
+            void cancel_timeout() {
+                timer_wheel->cancel(*this);
+            }
+        protected:
+            void timeout() override {
+                if(server)
+                    server->metrics.add(Metrics::Counter::timeouts);
+                close();
+            }
+        private:
+            std::shared_ptr<TimerWheel> timer_wheel;
+            /// Set once the connection has been accepted
+            ServerBase *server=nullptr;
+            /// Number of requests received on the connection
+            size_t requests=0;
+
+            /// Completion handlers and the control blocks of the responses are allocated here
+            HandlerMemory handler_memory;
+            /// Frames of coroutine resource functions are allocated here
+            FrameMemory frame_memory;
+            /// Bytes received but not yet parsed, kept across keep-alive requests
+            asio::streambuf read_buffer;
+
+            /// A request and its response. The Request is reused unless the application still holds it.
+            struct Exchange {
+                std::shared_ptr<Request> request;
+                std::unique_ptr<Response> response;
+            };
+
+            /// Guards the pipeline, which may be accessed from the thread releasing a response
+            std::mutex mutex;
+            /// Ring buffer of the pipelined requests whose responses have not been sent yet, in the order received.
+            /// The slot after the last one holds the request being read.
+            std::vector<Exchange> pipeline;
+            size_t head=0, count=0;
+            /// True while a write of the response at head is in progress
+            bool writing=false;
+            /// True once a request asked for the connection to be closed after its response
+            bool closing=false;
+            /// True once the socket has been closed with responses still held by the application
+            bool closed=false;
+            /// True while the read path owns read_buffer. It stops when it has to wait for the pending responses,
+            /// and is then resumed once they have been sent.
+            bool reading=true;
+            std::vector<asio::const_buffer> write_buffers;
+
+            void close() {
+                error_code ec;
+                socket.lowest_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                socket.lowest_layer().close(ec);
+            }
+
+            Exchange &slot(size_t index) {
+                return pipeline[(head+index)%pipeline.size()];
+            }
+            bool is_head(const Response *response) {
+                return count>0 && slot(0).response.get()==response;
+            }
+        };
+
         class Response : public std::ostream {
             friend class ServerBase<socket_type>;
+            friend class CoroutineHandler;
             //буфер для работы с вводом/выводом
             asio::streambuf streambuf;
 
-            std::shared_ptr<socket_type> socket;
+            /// Set while the response is in use
+            std::shared_ptr<Connection> connection;
+            /// True once the application has released the response
+            bool released=false;
+            Metrics::TimePoint released_time;
+            /// A send() waiting for the responses before this one
+            std::shared_ptr<Response> pending_send_response;
+            std::function<void(const error_code&)> pending_send_callback;
+            /// Status code and bytes sent so far, for the access log
+            unsigned sent_status=0;
+            uint64_t sent_bytes=0;
+            /// Set if the response fills the entry cache_key of the ResponseCache once released
+            const CachePolicy *cache_fill=nullptr;
+            std::string cache_key;
+            /// True once send() has been called, after which what has been written can no longer be taken back
+            bool sending=false;
+
+            Response(): std::ostream(&streambuf) {}
+
+            /// Buffers added with write_buffer(), each with the streambuf size at the time it was added
+            std::vector<std::pair<size_t, asio::const_buffer>> buffers;
+            std::vector<std::shared_ptr<const void>> buffer_owners;
+            size_t buffers_size=0;
+            std::vector<asio::const_buffer> gather;
+
+            /// Prepare for the next response on the connection, keeping the allocated memory
+            void reset() {
+                streambuf.consume(streambuf.size());
+                clear_buffers();
+                close_connection_after_response=false;
+                released=false;
+                sent_status=0;
+                sent_bytes=0;
+                sending=false;
+                clear();
+            }
+
+            /// The code of the status line at the start of what has not been sent yet, or 0
+            unsigned status_code() const {
+                auto data=static_cast<const char*>(asio::buffer_cast<const void*>(streambuf.data()));
+                auto size=streambuf.size();
+                if(!buffers.empty() && buffers.front().first==0) {
+                    data=asio::buffer_cast<const char*>(buffers.front().second);
+                    size=asio::buffer_size(buffers.front().second);
+                }
+                //"HTTP/1.1 200"
+                unsigned code=0;
+                if(size>=12 && std::memcmp(data, "HTTP/", 5)==0 && data[8]==' ') {
+                    for(size_t c=9;c<12 && data[c]>='0' && data[c]<='9';c++)
+                        code=code*10+static_cast<unsigned>(data[c]-'0');
+                }
+                return code;
+            }
+
+            /// Counts what is about to be sent, taking the status code from the status line at the start of the response
+            void account_sent() {
+                if(sent_bytes==0)
+                    sent_status=status_code();
+                sent_bytes+=size();
+            }
+
+            void clear_buffers() {
+                buffers.clear();
+                buffer_owners.clear();
+                buffers_size=0;
+            }
+
+            /// Copies parts to streambuf with one reservation
+            void append(std::initializer_list<boost::string_view> parts) {
+                size_t size=0;
+                for(auto &part: parts)
+                    size+=part.size();
+                auto buffer=asio::buffer_cast<char*>(streambuf.prepare(size));
+                for(auto &part: parts) {
+                    std::memcpy(buffer, part.data(), part.size());
+                    buffer+=part.size();
+                }
+                streambuf.commit(size);
+            }
+
+            /// The streambuf content interleaved with buffers, in the order they were written
+            const std::vector<asio::const_buffer> &gather_buffers() {
+                gather.clear();
+                append_buffers(gather);
+                return gather;
+            }
 
-            Response(const std::shared_ptr<socket_type> &socket): std::ostream(&streambuf), socket(socket) {}
+            void append_buffers(std::vector<asio::const_buffer> &result) const {
+                auto data=static_cast<const char*>(asio::buffer_cast<const void*>(streambuf.data()));
+                size_t position=0;
+                for(auto &buffer: buffers) {
+                    if(buffer.first>position)
+                        result.emplace_back(data+position, buffer.first-position);
+                    result.emplace_back(buffer.second);
+                    position=buffer.first;
+                }
+                if(streambuf.size()>position)
+                    result.emplace_back(data+position, streambuf.size()-position);
+            }
 
         public:
             size_t size() {
-                return streambuf.size();
+                return streambuf.size()+buffers_size;
+            }
+
+            /// Appends buffer to the response without copying it. owner is kept alive until the buffer has been sent.
+            /// Useful for sending cached or memory mapped content with one gather write.
+            void write_buffer(const asio::const_buffer &buffer, const std::shared_ptr<const void> &owner) {
+                buffers.emplace_back(streambuf.size(), buffer);
+                buffer_owners.emplace_back(owner);
+                buffers_size+=asio::buffer_size(buffer);
+            }
+
+            /// Writes the preformatted status line of code, for instance 200 for "HTTP/1.1 200 OK".
+            ///
+            /// write_status(), write_header(), write_date_header() and end_header() are faster than operator<<:
+            /// they copy each line to the buffer at once and format integers without the locale.
+            /// They can be mixed with operator<<.
+            Response &write_status(unsigned code) {
+                append({status_line(code)});
+                return *this;
+            }
+            Response &write_header(boost::string_view name, boost::string_view value) {
+                append({name, ": ", value, "\r\n"});
+                return *this;
+            }
+            Response &write_header(boost::string_view name, unsigned long long value) {
+                char digits[20];
+                append({name, ": ", boost::string_view(digits, format_decimal(value, digits)), "\r\n"});
+                return *this;
+            }
+            /// Writes the Date header, formatted once per second
+            Response &write_date_header() {
+                append({date_header()});
+                return *this;
+            }
+            /// Writes the empty line that ends the header
+            Response &end_header() {
+                append({"\r\n"});
+                return *this;
+            }
+
+            /// Writes data as one chunk of a response with Transfer-Encoding: chunked. Empty data is skipped,
+            /// since an empty chunk ends the content.
+            void write_chunk(const char *data, size_t size) {
+                if(size==0)
+                    return;
+                char header[chunk_header_size];
+                write(header, chunk_header(size, header));
+                write(data, size);
+                write("\r\n", 2);
+            }
+            /// Like write_chunk(), without copying buffer. owner is kept alive until the chunk has been sent.
+            void write_chunk(const asio::const_buffer &buffer, const std::shared_ptr<const void> &owner) {
+                if(asio::buffer_size(buffer)==0)
+                    return;
+                char header[chunk_header_size];
+                write(header, chunk_header(asio::buffer_size(buffer), header));
+                write_buffer(buffer, owner);
+                write("\r\n", 2);
+            }
+            /// Ends the content of a response with Transfer-Encoding: chunked
+            void write_last_chunk() {
+                write("0\r\n\r\n", 5);
             }
 
             /// If true, force server to close the connection after the response have been sent.
@@ -104,24 +423,94 @@ namespace SimpleWeb {
         class Request {
             friend class ServerBase<socket_type>;
             friend class Server<socket_type>;
+            asio::streambuf streambuf;
         public:
             std::string method, path, http_version;
 
             Content content;
 
-            std::unordered_multimap<std::string, std::string, CaseInsensitiveHash, CaseInsensitiveEqual> header;
+            typedef std::unordered_multimap<std::string, std::string, CaseInsensitiveHash, CaseInsensitiveEqual> Header;
+            Header header;
 
             
             std::string remote_endpoint_address;
             unsigned short remote_endpoint_port;
+
+            /// Parameters captured by the matching route, as slices of path
+            PathParameters path_parameters;
+
+            /// For routes added with stream_content: calls handler with the next piece of the content once it has been
+            /// received, or with an empty buffer once all of it has been read. The piece is valid until the next call.
+            /// Call again from handler to continue. The socket is only read while the application asks for content,
+            /// and at most Config::content_window bytes are received ahead of it.
+            /// Must not be called after the response has been released.
+            void read_content(const std::function<void(const error_code&, asio::const_buffer)> &handler) {
+                server->read_content(*this, handler);
+            }
          
-           
         private:
             Request(const socket_type &socket): content(streambuf) {
-                    remote_endpoint_address=socket.lowest_layer().remote_endpoint().address().to_string();
-                    remote_endpoint_port=socket.lowest_layer().remote_endpoint().port();
+                    error_code ec;
+                    auto endpoint=socket.lowest_layer().remote_endpoint(ec);
+                    remote_endpoint_address=ec ? std::string() : endpoint.address().to_string();
+                    remote_endpoint_port=ec ? 0 : endpoint.port();
+            }
+            RequestParser parser;
+            /// Nodes of header from earlier requests, reused to avoid allocations
+            std::vector<typename Header::node_type> spare_header_nodes;
+
+            ServerBase<socket_type> *server=nullptr;
+            /// When the first byte of the request was received, and when its header was complete
+            Metrics::TimePoint received, header_received;
+            /// The resource found for the request, or the methods allowed for its path
+            const ResourceFunction *resource_function=nullptr;
+            const std::string *allow=nullptr;
+            /// True if resource_function runs on the OffloadExecutor
+            bool offload=false;
+            /// Set if the responses of resource_function are cached
+            const CachePolicy *cache_policy=nullptr;
+
+            bool chunked=false;
+            ChunkedDecoder chunked_decoder;
+            /// Set while content is streamed to the application
+            std::shared_ptr<Connection> content_connection;
+            /// Content-Length content not yet handed to the application
+            unsigned long long content_remaining=0;
+            /// Bytes of the connection's read_buffer handed to the application by the last read_content()
+            size_t content_consume=0;
+
+            /// Prepare for the next request on the connection, keeping the allocated memory
+            void reset() {
+                method.clear();
+                path.clear();
+                http_version.clear();
+                while(!header.empty())
+                    spare_header_nodes.emplace_back(header.extract(header.begin()));
+                streambuf.consume(streambuf.size());
+                content.clear();
+                path_parameters.clear();
+                parser.reset();
+                resource_function=nullptr;
+                allow=nullptr;
+                offload=false;
+                cache_policy=nullptr;
+                chunked=false;
+                chunked_decoder.reset();
+                content_remaining=0;
+                content_consume=0;
+            }
+
+            void add_header(boost::string_view name, boost::string_view value) {
+                if(spare_header_nodes.empty()) {
+                    header.emplace(std::string(name.data(), name.size()), std::string(value.data(), value.size()));
+                    return;
+                }
+                auto node=std::move(spare_header_nodes.back());
+                spare_header_nodes.pop_back();
+                node.key().assign(name.data(), name.size());
+                node.mapped().assign(value.data(), value.size());
+                header.insert(std::move(node));
             }
-            asio::streambuf streambuf;
         };
         
         class Config {
@@ -135,13 +524,60 @@ namespace SimpleWeb {
             size_t thread_pool_size=1;
             /// Timeout on request handling. Defaults to 5 seconds.
             size_t timeout_request=5;
-            /// Timeout on content handling. Defaults to 300 seconds.
+            /// Timeout on content handling. Restarted by every read of request content and every write of a response,
+            /// so that it limits a stalled client rather than a long transfer. Defaults to 300 seconds.
             size_t timeout_content=300;
+            /// Timeout on waiting for the next request on a keep-alive connection. Defaults to 5 seconds.
+            size_t timeout_idle_keepalive=5;
+            /// Maximum size of the request line and headers. Larger requests are answered with 431. Defaults to 64 KB.
+            size_t max_request_header_size=65536;
+            /// Maximum number of request headers. Defaults to 100, at most RequestParser::header_capacity.
+            size_t max_request_headers=100;
+            /// Maximum number of pipelined requests on a connection whose responses have not been sent yet.
+            /// Further requests are read once these responses have been sent. Defaults to 16.
+            size_t max_pipelined_requests=16;
+            /// Maximum size of the content that is read before the resource function is called.
+            /// Larger requests are answered with 413. Does not apply to routes added with stream_content.
+            /// Defaults to no limit.
+            size_t max_request_content_size=std::numeric_limits<size_t>::max();
+            /// Maximum number of bytes of streamed content that are received ahead of the application.
+            /// Reading from the socket pauses until the application asks for more content. Defaults to 64 KB.
+            size_t content_window=65536;
             /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
             /// If empty, the address will be any address.
             std::string address;
             /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
             bool reuse_address=true;
+            /// If true, each of the thread_pool_size threads runs its own io_service with its own acceptor
+            /// bound with SO_REUSEPORT, so that a connection stays on the thread that accepted it.
+            /// If false, all threads share io_service. Defaults to false.
+            bool io_service_per_thread=false;
+            /// Maximum number of open connections. Accepting pauses while it is reached, leaving further connections
+            /// in the listen backlog, and resumes when a connection closes. Defaults to 0, no limit.
+            size_t max_connections=0;
+            /// Maximum number of waiting connections accepted at once before the io_service handles other work.
+            /// Defaults to 16.
+            size_t accept_batch=16;
+            /// Milliseconds to wait before accepting again when the process or system is out of file descriptors
+            /// or memory. Defaults to 100 ms.
+            size_t accept_backoff=100;
+            /// Requests arriving while this many requests are in progress, received but not yet answered,
+            /// are answered with 503 Service Unavailable without being parsed. Defaults to 0, no limit.
+            size_t max_requests_in_progress=0;
+            /// Requests arriving while the io_service of their connection runs this many milliseconds late
+            /// are answered with 503 Service Unavailable without being parsed. Defaults to 0, no limit.
+            size_t max_event_loop_lag=0;
+            /// Seconds in the Retry-After header of the 503 responses. Defaults to 1.
+            size_t retry_after=1;
+            /// Number of worker threads running the resource functions of routes added with offload. Defaults to 4.
+            size_t offload_threads=4;
+            /// Maximum number of offloaded requests queued per worker thread. Requests to offloaded routes arriving
+            /// while every queue is full are answered with 503 Service Unavailable. Defaults to 256.
+            size_t offload_queue_size=256;
+            /// Memory budget in bytes of the cache of the routes added with a CachePolicy. Defaults to 64 MB.
+            size_t response_cache_size=64*1024*1024;
+            /// Number of independently locked parts of the response cache. Defaults to 16.
+            size_t response_cache_shards=16;
         };
         ///Set before calling start().
         Config config;
@@ -149,35 +585,149 @@ namespace SimpleWeb {
    
     public:
         /// Warning: do not add or remove resources after start() is called
+
+        /// Adds a resource for method and path pattern, for instance "/api/users/{id}" or "/static/*".
+        /// The captured parameters are found in Request::path_parameters. See Router for the pattern syntax.
+        /// Routes take precedence over default_resource. A path that matches a route, but not for the requested method,
+        /// is answered by default_resource for that method if there is one, or else with 405. A request without any
+        /// matching resource is answered with 404.
+        /// If resource_function throws, what it has written is replaced with a 500 response, or, once it has called
+        /// send(), the connection is closed after it.
+        ///
+        /// If stream_content is true, resource_function is called as soon as the header has been received,
+        /// and reads the content, plain or chunked, with Request::read_content().
+        ///
+        /// If offload is true, resource_function runs on a worker thread of the OffloadExecutor instead of the
+        /// io_service, for resources that block or use much CPU. The response is sent once it has been released,
+        /// on the io_service of the connection. Offloaded routes cannot stream content.
+        void route(const std::string &method, const std::string &pattern, const ResourceFunction &resource_function,
+                   bool stream_content=false, bool offload=false) {
+            if(stream_content && offload)
+                throw std::invalid_argument("route: offloaded routes cannot stream content: "+pattern);
+            router.add(method, pattern, Resource{resource_function, stream_content, offload, nullptr});
+            if(offload)
+                offloaded_routes=true;
+        }
+
+        /// How the responses of a resource are cached
+        struct CachePolicy {
+            /// How long a response is served from the cache
+            std::chrono::milliseconds ttl;
+            /// Request headers whose values, in addition to the method and the path with its query string,
+            /// tell responses apart, for instance Accept-Encoding
+            std::vector<std::string> vary;
+        };
+
+        /// Adds a resource whose responses are cached as sent, in memory, for cache_policy.ttl. Only complete 200
+        /// responses, with Content-Length or chunked content, that are released without send() and without
+        /// close_connection_after_response are cached.
+        /// Requests arriving while the response for the same key is produced wait for it, and all of them are sent
+        /// the same bytes. See Config::response_cache_size.
+        void route(const std::string &method, const std::string &pattern, const ResourceFunction &resource_function,
+                   const CachePolicy &cache_policy, bool offload=false) {
+            router.add(method, pattern, Resource{resource_function, false, offload, std::make_shared<CachePolicy>(cache_policy)});
+            if(offload)
+                offloaded_routes=true;
+            cached_routes=true;
+        }
         
-        std::map<std::string,
-            std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>, std::shared_ptr<typename ServerBase<socket_type>::Request>)> > default_resource;
+        /// Resources for requests that do not match a route, by method
+        std::map<std::string, ResourceFunction> default_resource;
+        /// Caching of the responses of default_resource, by method. See route() with a CachePolicy.
+        std::map<std::string, CachePolicy> default_resource_cache;
+
+        /// Counters and latency histograms of the requests handled by the server
+        Metrics metrics;
+        /// Returns a resource function responding with metrics in the Prometheus text format,
+        /// for instance for route("GET", "/metrics", server.metrics_resource())
+        ResourceFunction metrics_resource() {
+            return [this](std::shared_ptr<Response> response, std::shared_ptr<Request> /*request*/) {
+                std::ostringstream content;
+                metrics.write(content);
+                auto body=content.str();
+                response->write_status(200).write_header("Content-Type", "text/plain; version=0.0.4")
+                         .write_header("Content-Length", body.size()).end_header();
+                response->write(body.data(), static_cast<std::streamsize>(body.size()));
+            };
+        }
         
         std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Request>, const error_code&)> on_error;
         
         virtual void start() {
+            router.compile();
+            overload_response="HTTP/1.1 503 Service Unavailable\r\nRetry-After: "+std::to_string(config.retry_after)+
+                              "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
             if(!io_service)
                 io_service=std::make_shared<asio::io_service>();
 
             if(io_service->stopped())
                 io_service->reset();
 
+            //One io_service per thread if requested and the platform lets several acceptors share the port
+            io_services.clear();
+            io_services.emplace_back(io_service);
+#ifdef SO_REUSEPORT
+            if(config.io_service_per_thread) {
+                for(size_t c=1;c<config.thread_pool_size;c++)
+                    io_services.emplace_back(std::make_shared<asio::io_service>());
+            }
+#endif
+
             asio::ip::tcp::endpoint endpoint;
-            endpoint=asio::ip::tcp::endpoint(asio::ip::address::from_string(config.address), config.port);
+            if(config.address.size()>0)
+                endpoint=asio::ip::tcp::endpoint(asio::ip::address::from_string(config.address), config.port);
+            else
+                endpoint=asio::ip::tcp::endpoint(asio::ip::tcp::v4(), config.port);
             
-            //acceptor is used for accepting new socket connections.
-            if(!acceptor)
-                acceptor=std::unique_ptr<asio::ip::tcp::acceptor>(new asio::ip::tcp::acceptor(*io_service));
-            //Open the acceptor using the protocol.
-            acceptor->open(endpoint.protocol());
-            acceptor->set_option(asio::socket_base::reuse_address(config.reuse_address));
-            //Bind the acceptor to the given local endpoint.
-            acceptor->bind(endpoint);
-            //Place the acceptor into the state where it will listen for new connections.
-            acceptor->listen();
+            //Timeouts of the connections of each io_service
+            timer_wheels.clear();
+            for(auto &service: io_services)
+                timer_wheels.emplace_back(std::make_shared<TimerWheel>(*service));
+            io_services_created();
+
+            //acceptor is used for accepting new socket connections, one per io_service.
+            acceptors.clear();
+            accept_timers.clear();
+            paused_acceptors.clear();
+            for(auto &service: io_services) {
+                std::unique_ptr<asio::ip::tcp::acceptor> acceptor(new asio::ip::tcp::acceptor(*service));
+                //Open the acceptor using the protocol.
+                acceptor->open(endpoint.protocol());
+                acceptor->set_option(asio::socket_base::reuse_address(config.reuse_address));
+#ifdef SO_REUSEPORT
+                if(io_services.size()>1)
+                    acceptor->set_option(reuse_port(true));
+#endif
+                //Bind the acceptor to the given local endpoint.
+                acceptor->bind(endpoint);
+                //Place the acceptor into the state where it will listen for new connections.
+                acceptor->listen();
+                //Lets accept() take the rest of a batch without blocking
+                acceptor->non_blocking(true);
+                acceptors.emplace_back(std::move(acceptor));
+                accept_timers.emplace_back(new asio::steady_timer(*service));
+            }
      
-            accept(); 
+            //Replaces the executor of an earlier start(), once its workers are done
+            offload_executor.reset();
+            if(offloaded_routes)
+                offload_executor=std::unique_ptr<OffloadExecutor>(new OffloadExecutor(config.offload_threads, config.offload_queue_size));
+            response_cache.reset();
+            if(cached_routes || !default_resource_cache.empty())
+                response_cache=std::unique_ptr<ResponseCache>(new ResponseCache(config.response_cache_size, config.response_cache_shards));
+
+            for(size_t c=0;c<acceptors.size();c++)
+                accept(c);
 
+            //If thread_pool_size>1, start additional threads, each running its own or the shared io_service
+            threads.clear();
+            for(size_t c=1;c<config.thread_pool_size;c++) {
+                auto service=io_services.size()>1 ? io_services[c] : io_service;
+                threads.emplace_back([service]() {
+                    service->run();
+                });
+            }
 
             //Main thread
             if(config.thread_pool_size>0)
@@ -189,196 +739,1089 @@ namespace SimpleWeb {
             }
         }
         
-        void stop() {
-            acceptor->close();
-            if(config.thread_pool_size>0)
-                io_service->stop();
+        virtual void stop() {
+            for(auto &acceptor: acceptors)
+                acceptor->close();
+            for(auto &timer: accept_timers)
+                timer->cancel();
+            if(offload_executor)
+                offload_executor->stop();
+            if(config.thread_pool_size>0) {
+                for(auto &service: io_services)
+                    service->stop();
+            }
         }
         
         ///Use this function if you need to recursively send parts of a longer message
+        ///
+        ///With pipelined requests, the data is sent once the responses to the earlier requests have been sent.
         void send(const std::shared_ptr<Response> &response, const std::function<void(const error_code&)>& callback=nullptr) const {
-            asio::async_write(*response->socket, response->streambuf, [this, response, callback](const error_code& ec, size_t /*bytes_transferred*/) {
-                if(callback)
-                    callback(ec);
+            response->sending=true;
+            //A response sent in parts is not cached
+            if(response->cache_fill) {
+                response->cache_fill=nullptr;
+                response_cache->abandon(response->cache_key);
+            }
+            auto &connection=*response->connection;
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            if(connection.is_head(response.get()) && !connection.writing)
+                send_head(response, callback);
+            else {
+                response->pending_send_response=response;
+                response->pending_send_callback=callback;
+            }
+        }
+
+        /// Sends what has been written to response, followed by length bytes of file starting at offset.
+        /// The file body is sent with sendfile(2) without copying it to user space, falling back to
+        /// pread and write if the kernel does not support sendfile for this file.
+        void send_file(const std::shared_ptr<Response> &response, const std::shared_ptr<File> &file, size_t offset, size_t length,
+                       const std::function<void(const error_code&)>& callback=nullptr) const {
+            auto operation=std::make_shared<SendFileOperation>(response, file, offset, length, callback);
+            //Also when there is nothing to send yet, since send() waits for the earlier pipelined responses
+            send(response, [this, operation](const error_code &ec) {
+                if(!ec)
+                    this->send_file_some(operation);
+                else if(operation->callback)
+                    operation->callback(ec);
             });
         }
 
         /// If you have your own asio::io_service, store its pointer here before running start().
         /// You might also want to set config.thread_pool_size to 0.
         std::shared_ptr<asio::io_service> io_service;
+
+        /// If set, every response that has been sent is logged to it, from the thread that sent it. Set before running start().
+        std::shared_ptr<AccessLog> access_log;
     protected:
-        std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
+#ifdef SO_REUSEPORT
+        typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+        /// io_service followed by the per-thread io_services, if any
+        std::vector<std::shared_ptr<asio::io_service>> io_services;
+        std::vector<std::unique_ptr<asio::ip::tcp::acceptor>> acceptors;
+        /// Delays accepting after running out of file descriptors, one per acceptor
+        std::vector<std::unique_ptr<asio::steady_timer>> accept_timers;
+        std::vector<std::shared_ptr<TimerWheel>> timer_wheels;
         std::vector<std::thread> threads;
+
+        /// Guards connections and paused_acceptors
+        std::mutex accept_mutex;
+        size_t connections=0;
+        /// Indices of the acceptors waiting for a connection to close, because max_connections was reached
+        std::vector<size_t> paused_acceptors;
+        /// Requests received and not yet answered, on all connections
+        std::atomic<size_t> requests_in_progress{0};
+        /// The response to requests that are shed, formatted by start()
+        std::string overload_response;
+
+        struct Resource {
+            ResourceFunction function;
+            bool stream_content;
+            bool offload;
+            std::shared_ptr<const CachePolicy> cache_policy;
+        };
+        Router<Resource> router;
+        bool offloaded_routes=false;
+        /// Runs the resource functions of offloaded routes. Created by start() if there are any.
+        std::unique_ptr<OffloadExecutor> offload_executor;
+        bool cached_routes=false;
+        /// Responses of the resources with a CachePolicy. Created by start() if there are any.
+        std::unique_ptr<ResponseCache> response_cache;
         
         ServerBase(unsigned short port) : config(port) {}
-        
-        virtual void accept()=0;
-        
-        std::shared_ptr<asio::deadline_timer> get_timeout_timer(const std::shared_ptr<socket_type> &socket, long seconds) {
-            if(seconds==0)
-                return nullptr;
-            
-            auto timer=std::make_shared<asio::deadline_timer>(*io_service);
-            timer->expires_from_now(boost::posix_time::seconds(seconds));
-            timer->async_wait([socket](const error_code& ec){
+
+        class SendFileOperation {
+        public:
+            SendFileOperation(const std::shared_ptr<Response> &response, const std::shared_ptr<File> &file, size_t offset, size_t length,
+                              const std::function<void(const error_code&)> &callback) :
+                    response(response), file(file), offset(static_cast<off_t>(offset)), remaining(length), callback(callback) {}
+            std::shared_ptr<Response> response;
+            std::shared_ptr<File> file;
+            off_t offset;
+            size_t remaining;
+            std::function<void(const error_code&)> callback;
+#ifdef __linux__
+            bool use_sendfile=true;
+#else
+            bool use_sendfile=false;
+#endif
+            /// Only allocated if sendfile is not available
+            std::vector<char> buffer;
+        };
+
+        /// Each wait for the socket to become writable is limited by config.timeout_content, rather than the whole file
+        void send_file_some(const std::shared_ptr<SendFileOperation> &operation) const {
+            auto &connection=*operation->response->connection;
+            auto &socket=connection.socket.lowest_layer();
+#ifdef __linux__
+            if(operation->use_sendfile) {
+                error_code ec;
+                socket.native_non_blocking(true, ec);
+                while(!ec && operation->remaining>0) {
+                    auto sent=::sendfile(socket.native_handle(), operation->file->native_handle(), &operation->offset, operation->remaining);
+                    if(sent>0) {
+                        metrics.add(Metrics::Counter::bytes_sent, static_cast<uint64_t>(sent));
+                        operation->response->sent_bytes+=static_cast<uint64_t>(sent);
+                        operation->remaining-=static_cast<size_t>(sent);
+                    }
+                    else if(sent==0) //File shorter than expected
+                        ec=make_error_code::make_error_code(errc::no_message_available);
+                    else if(errno==EINTR)
+                        continue;
+                    else if(errno==EAGAIN || errno==EWOULDBLOCK) {
+                        connection.set_timeout(config.timeout_content);
+                        socket.async_wait(asio::ip::tcp::socket::wait_write, [this, operation](const error_code &ec) {
+                            if(!ec)
+                                this->send_file_some(operation);
+                            else
+                                this->send_file_done(*operation, ec);
+                        });
+                        return;
+                    }
+                    else if(errno==EINVAL || errno==ENOSYS || errno==EOPNOTSUPP) {
+                        operation->use_sendfile=false;
+                        break;
+                    }
+                    else
+                        ec=error_code(errno, boost::system::system_category());
+                }
+                if(operation->use_sendfile) {
+                    send_file_done(*operation, ec);
+                    return;
+                }
+            }
+#endif
+            if(operation->remaining==0) {
+                send_file_done(*operation, error_code());
+                return;
+            }
+            //Fallback: read and send 128 KB at a time through a buffer owned by this operation
+            if(operation->buffer.empty())
+                operation->buffer.resize(131072);
+            auto read_length=::pread(operation->file->native_handle(), &operation->buffer[0],
+                                     std::min(operation->buffer.size(), operation->remaining), operation->offset);
+            if(read_length<=0) {
+                send_file_done(*operation, read_length==0 ? make_error_code::make_error_code(errc::no_message_available) :
+                                                            error_code(errno, boost::system::system_category()));
+                return;
+            }
+            connection.set_timeout(config.timeout_content);
+            asio::async_write(connection.socket, asio::buffer(&operation->buffer[0], static_cast<size_t>(read_length)),
+                              [this, operation](const error_code &ec, size_t bytes_transferred) {
                 if(!ec) {
-                    error_code ec;
-                    socket->lowest_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-                    socket->lowest_layer().close();
+                    operation->offset+=static_cast<off_t>(bytes_transferred);
+                    operation->remaining-=bytes_transferred;
+                    metrics.add(Metrics::Counter::bytes_sent, bytes_transferred);
+                    operation->response->sent_bytes+=bytes_transferred;
+                    this->send_file_some(operation);
                 }
+                else
+                    this->send_file_done(*operation, ec);
             });
-            return timer;
+        }
+
+        /// Stops timing the connection once the whole file has been sent, until the response is released.
+        /// After an error, the timeout closes the connection if the application does not.
+        void send_file_done(SendFileOperation &operation, const error_code &ec) const {
+            if(!ec)
+                operation.response->connection->cancel_timeout();
+            if(operation.callback)
+                operation.callback(ec);
         }
         
-        void read_request_and_content(const std::shared_ptr<socket_type> &socket) {
-            //Create new streambuf (Request::streambuf) for async_read_until()
-            //shared_ptr is used to pass temporary objects to the asynchronous functions
-            std::shared_ptr<Request> request(new Request(*socket));
+        /// Called by start() once io_services and timer_wheels have been created, before accepting
+        virtual void io_services_created() {}
 
-            //Set timeout on the following asio::async-read or write function
-            auto timer=this->get_timeout_timer(socket, config.timeout_request);
-                        
-            asio::async_read_until(*socket, request->streambuf, "\r\n\r\n",
-                    [this, socket, request, timer](const error_code& ec, size_t bytes_transferred) {
-                if(timer)
-                    timer->cancel();
-                if(!ec) {
-                    //request->streambuf.size() is not necessarily the same as bytes_transferred, from Boost-docs:
-                    //"After a successful async_read_until operation, the streambuf may contain additional data beyond the delimiter"
-                    //The chosen solution is to extract lines from the stream directly when parsing the header. What is left of the
-                    //streambuf (maybe some bytes of the content) is appended to in the async_read-function below (for retrieving content).
-                    size_t num_additional_bytes=request->streambuf.size()-bytes_transferred;
-                    
-                    if(!this->parse_request(request))
-                        return;
-                    
-                    //If content, read that as well
-                    auto it=request->header.find("Content-Length");
-                    if(it!=request->header.end()) {
-                        unsigned long long content_length;
-                        try {
-                            content_length=stoull(it->second);
-                        }
-                        catch(const std::exception &e) {
-                            if(on_error)
-                                on_error(request, make_error_code::make_error_code(errc::protocol_error));
-                            return;
-                        }
-                        if(content_length>num_additional_bytes) {
-                            //Set timeout on the following asio::async-read or write function
-                            auto timer=this->get_timeout_timer(socket, config.timeout_content);
-                            asio::async_read(*socket, request->streambuf,
-                                    asio::transfer_exactly(content_length-num_additional_bytes),
-                                    [this, socket, request, timer]
-                                    (const error_code& ec, size_t /*bytes_transferred*/) {
-                                if(timer)
-                                    timer->cancel();
-                                if(!ec)
-                                    this->find_resource(socket, request);
-                                else if(on_error)
-                                    on_error(request, ec);
-                            });
-                        }
-                        else
-                            this->find_resource(socket, request);
+        /// Accepts connections on acceptors[index]
+        virtual void accept(size_t index)=0;
+
+        /// Registers an accepted connection. Returns false if max_connections has been reached, in which case
+        /// acceptor index is paused, and accept(index) is called again once a connection has closed.
+        bool connection_accepted(Connection &connection, size_t index) {
+            connection.server=this;
+            metrics.add(Metrics::Counter::connections_accepted);
+            std::lock_guard<std::mutex> lock(accept_mutex);
+            if(config.max_connections==0 || ++connections<config.max_connections)
+                return true;
+            paused_acceptors.emplace_back(index);
+            return false;
+        }
+
+        /// Called when an accepted connection is destroyed, on any thread
+        void connection_closed(Connection &connection) {
+            metrics.add(Metrics::Counter::connections_closed);
+            //Requests that were still held by the application when the connection closed
+            if(connection.count>0)
+                requests_in_progress.fetch_sub(connection.count, std::memory_order_relaxed);
+            if(config.max_connections==0)
+                return;
+            std::lock_guard<std::mutex> lock(accept_mutex);
+            connections--;
+            if(!paused_acceptors.empty()) {
+                auto index=paused_acceptors.back();
+                paused_acceptors.pop_back();
+                asio::post(acceptors[index]->get_executor(), [this, index] {
+                    this->accept(index);
+                });
+            }
+        }
+
+        /// Handles an error from accepting on acceptors[index], other than operation_aborted. Returns true if the
+        /// acceptor can accept again right away, and false if accept(index) is called after config.accept_backoff,
+        /// since the process or the system has run out of file descriptors or memory.
+        bool accept_failed(size_t index, const std::shared_ptr<Connection> &connection, const error_code &ec) {
+            if(on_error)
+                on_error(std::shared_ptr<Request>(new Request(connection->socket)), ec);
+            if(ec!=asio::error::no_descriptors && ec!=asio::error::no_buffer_space && ec!=asio::error::no_memory &&
+               !(ec.category()==boost::system::system_category() && ec.value()==ENFILE))
+                return true;
+            auto &timer=*accept_timers[index];
+            timer.expires_after(std::chrono::milliseconds(config.accept_backoff));
+            timer.async_wait([this, index](const error_code &ec) {
+                if(!ec)
+                    this->accept(index);
+            });
+            return false;
+        }
+
+        /// Returns true if a request arriving on connection is to be shed, since the server is overloaded
+        bool overloaded(const Connection &connection) const {
+            return (config.max_requests_in_progress>0 &&
+                    requests_in_progress.load(std::memory_order_relaxed)>=config.max_requests_in_progress) ||
+                   (config.max_event_loop_lag>0 &&
+                    connection.timer_wheel->lag()>=std::chrono::milliseconds(config.max_event_loop_lag));
+        }
+
+        /// Non-owning view of a vector of buffers, since asio copies the buffer sequence into the write operation
+        class BufferSequence {
+        public:
+            typedef asio::const_buffer value_type;
+            typedef const asio::const_buffer *const_iterator;
+            explicit BufferSequence(const std::vector<asio::const_buffer> &buffers) : first(buffers.data()), last(buffers.data()+buffers.size()) {}
+            const_iterator begin() const {
+                return first;
+            }
+            const_iterator end() const {
+                return last;
+            }
+        private:
+            const_iterator first, last;
+        };
+
+        /// Sends what has been written to response, which is at the head of the pipeline. Called with the connection locked.
+        void send_head(const std::shared_ptr<Response> &response, const std::function<void(const error_code&)>& callback) const {
+            auto &connection=*response->connection;
+            connection.writing=true;
+            connection.set_timeout(config.timeout_content);
+            auto handler=make_handler(connection.handler_memory, [this, response, callback](const error_code& ec, size_t bytes_transferred) {
+                metrics.add(Metrics::Counter::bytes_sent, bytes_transferred);
+                {
+                    std::lock_guard<std::mutex> lock(response->connection->mutex);
+                    response->connection->writing=false;
+                    if(access_log)
+                        response->account_sent();
+                    response->streambuf.consume(response->streambuf.size());
+                    response->clear_buffers();
+                    //A send() made while this one was in progress
+                    if(!ec && response->pending_send_response) {
+                        auto pending_response=std::move(response->pending_send_response);
+                        auto pending_callback=std::move(response->pending_send_callback);
+                        response->pending_send_callback=nullptr;
+                        this->send_head(pending_response, pending_callback);
                     }
-                    else
-                        this->find_resource(socket, request);
                 }
-                else if(on_error)
-                    on_error(request, ec);
+                if(callback)
+                    callback(ec);
             });
+            if(response->buffers.empty())
+                asio::async_write(connection.socket, response->streambuf.data(), std::move(handler));
+            else //Send the streambuf and the added buffers with one gather write
+                asio::async_write(connection.socket, BufferSequence(response->gather_buffers()), std::move(handler));
         }
+        
+        /// The caller sets the timeout on waiting for the request
+        void read_request_and_content(const std::shared_ptr<Connection> &connection) {
+            std::shared_ptr<Request> request;
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                if(connection->pipeline.empty())
+                    connection->pipeline.resize(std::max(config.max_pipelined_requests, static_cast<size_t>(1)));
+                //The rest is read once the earlier responses have been sent
+                if(connection->closing || connection->count==connection->pipeline.size()) {
+                    connection->reading=false;
+                    return;
+                }
+                request=connection->slot(connection->count).request;
+            }
+            //Reuse the Request of an earlier request on this connection if the application no longer holds it
+            if(request && request.use_count()==2)
+                request->reset();
+            else {
+                request=std::shared_ptr<Request>(new Request(connection->socket));
+                request->server=this;
+                request->parser.max_header_size=config.max_request_header_size;
+                request->parser.max_headers=config.max_request_headers;
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->slot(connection->count).request=request;
+            }
 
-        bool parse_request(const std::shared_ptr<Request> &request) const {
-            std::string line;
-            getline(request->content, line);
-            size_t method_end;
-            if((method_end=line.find(' '))!=std::string::npos) {
-                size_t path_end;
-                if((path_end=line.find(' ', method_end+1))!=std::string::npos) {
-                    request->method=line.substr(0, method_end);
-                    request->path=line.substr(method_end+1, path_end-method_end-1);
-
-                    size_t protocol_end;
-                    if((protocol_end=line.find('/', path_end+1))!=std::string::npos) {
-                        if(line.compare(path_end+1, protocol_end-path_end-1, "HTTP")!=0)
-                            return false;
-                        request->http_version=line.substr(protocol_end+1, line.size()-protocol_end-2);
-                    }
-                    else
-                        return false;
-
-                    getline(request->content, line);
-                    size_t param_end;
-                    while((param_end=line.find(':'))!=std::string::npos) {
-                        size_t value_start=param_end+1;
-                        if((value_start)<line.size()) {
-                            if(line[value_start]==' ')
-                                value_start++;
-                            if(value_start<line.size())
-                                request->header.emplace(line.substr(0, param_end), line.substr(value_start, line.size()-value_start-1));
-                        }
-    
-                        getline(request->content, line);
+            //Bytes of this request may already have been received with the previous one
+            if(connection->read_buffer.size()>0) {
+                request->received=Metrics::now();
+                if(overloaded(*connection))
+                    shed_request(connection, request);
+                else
+                    parse_request_header(connection, request);
+            }
+            else if(!wait_for_responses(*connection))
+                read_request(connection, request);
+        }
+
+        /// Reads until the parser has seen the complete header
+        void read_request(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {
+            connection->socket.async_read_some(connection->read_buffer.prepare(4096), make_handler(connection->handler_memory,
+                    [this, connection, request](const error_code& ec, size_t bytes_transferred) {
+                if(ec) {
+                    connection->cancel_timeout();
+                    if(on_error)
+                        on_error(request, ec);
+                    return;
+                }
+                //A keep-alive connection that was idle now has timeout_request to complete the request
+                auto first_bytes=connection->read_buffer.size()==0;
+                if(first_bytes) {
+                    connection->set_timeout(config.timeout_request);
+                    request->received=Metrics::now();
+                }
+                connection->read_buffer.commit(bytes_transferred);
+                metrics.add(Metrics::Counter::bytes_received, bytes_transferred);
+                if(first_bytes && this->overloaded(*connection)) {
+                    this->shed_request(connection, request);
+                    return;
+                }
+
+                this->parse_request_header(connection, request);
+            }));
+        }
+
+        /// Parses the received bytes, then reads the content, if any
+        void parse_request_header(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {
+            auto &read_buffer=connection->read_buffer;
+            auto data=static_cast<const char*>(asio::buffer_cast<const void*>(read_buffer.data()));
+            auto parse_start=Metrics::now();
+            auto result=request->parser.parse(data, read_buffer.size());
+            if(result==RequestParser::Result::incomplete) {
+                //While pipelined responses are pending, the rest of this request is read after they have been sent
+                if(!wait_for_responses(*connection))
+                    read_request(connection, request);
+                return;
+            }
+            if(result!=RequestParser::Result::complete) {
+                write_error_and_close(connection, request, result==RequestParser::Result::too_large ?
+                    "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" :
+                    "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                return;
+            }
+
+            parse_request(request);
+            request->header_received=Metrics::now();
+            metrics.record(Metrics::Stage::read_header, request->received, request->header_received);
+            metrics.record(Metrics::Stage::parse, parse_start, request->header_received);
+            auto stream_content=route_request(*request);
+            metrics.record(Metrics::Stage::route, request->header_received, Metrics::now());
+            auto header_length=request->parser.header_length();
+
+            //Find the length of the content, if any
+            unsigned long long content_length=0;
+            //Too long for the small string optimization, so not constructed for every request
+            static const std::string transfer_encoding("Transfer-Encoding");
+            auto it=request->header.find(transfer_encoding);
+            if(it!=request->header.end()) {
+                //The content length is only known if chunked is the last coding. Compared in place, on the hot path.
+                boost::string_view coding(it->second);
+                auto comma=coding.rfind(',');
+                if(comma!=boost::string_view::npos)
+                    coding.remove_prefix(comma+1);
+                while(!coding.empty() && (coding.front()==' ' || coding.front()=='\t'))
+                    coding.remove_prefix(1);
+                while(!coding.empty() && (coding.back()==' ' || coding.back()=='\t'))
+                    coding.remove_suffix(1);
+                auto is_chunked=coding.size()==7 && std::equal(coding.begin(), coding.end(), "chunked", [](char a, char b) {
+                    return tolower(a)==b;
+                });
+                if(!is_chunked) {
+                    write_error_and_close(connection, request, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    return;
+                }
+                request->chunked=true;
+            }
+            else {
+                //Only plain digits, since a length read differently by a proxy in front would let a request be
+                //smuggled in the content of another. Repeated headers must agree.
+                auto range=request->header.equal_range("Content-Length");
+                bool valid=true;
+                if(range.first!=range.second)
+                    valid=parse_decimal(range.first->second, content_length);
+                for(auto other=range.first;valid && other!=range.second;++other)
+                    valid=other->second==range.first->second;
+                if(!valid) {
+                    write_error_and_close(connection, request, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    return;
+                }
+                if(!stream_content && content_length>config.max_request_content_size) {
+                    write_error_and_close(connection, request, "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    return;
+                }
+            }
+
+            if(stream_content) {
+                //The content follows the header in read_buffer, so the pending responses are sent first
+                if(wait_for_responses(*connection)) {
+                    request->reset();
+                    return;
+                }
+                read_buffer.consume(header_length);
+                if(request->chunked || content_length>0) {
+                    request->content_remaining=content_length;
+                    request->content_connection=connection;
+                }
+                find_resource(connection, request);
+                return;
+            }
+
+            if(request->chunked) {
+                if(!request->chunked_decoder.is_complete(data+header_length, read_buffer.size()-header_length) && 
+                   wait_for_responses(*connection)) {
+                    //Parsed again once the pending responses have been sent
+                    request->reset();
+                    return;
+                }
+                read_buffer.consume(header_length);
+                read_chunked_content(connection, request);
+                return;
+            }
+
+            if(content_length>read_buffer.size()-header_length && wait_for_responses(*connection)) {
+                //Parsed again once the pending responses have been sent
+                request->reset();
+                return;
+            }
+            read_buffer.consume(header_length);
+            if(content_length==0) {
+                find_resource(connection, request);
+                return;
+            }
+            //Move the content that has already been received to Request::streambuf, and read the rest directly into it
+            auto num_additional_bytes=std::min(static_cast<unsigned long long>(read_buffer.size()), content_length);
+            request->streambuf.commit(asio::buffer_copy(request->streambuf.prepare(num_additional_bytes), read_buffer.data(), num_additional_bytes));
+            read_buffer.consume(num_additional_bytes);
+            if(content_length>num_additional_bytes)
+                read_sized_content(connection, request, content_length-num_additional_bytes);
+            else
+                find_resource(connection, request);
+        }
+
+        /// Reads the remaining bytes of Content-Length content into Request::streambuf, then calls find_resource
+        void read_sized_content(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
+                                unsigned long long remaining) {
+            //Set timeout on the following asio::async-read or write function. No responses are pending here.
+            connection->set_timeout(config.timeout_content);
+            auto size=static_cast<size_t>(std::min(remaining, static_cast<unsigned long long>(config.content_window)));
+            connection->socket.async_read_some(request->streambuf.prepare(size), make_handler(connection->handler_memory,
+                    [this, connection, request, remaining](const error_code& ec, size_t bytes_transferred) {
+                if(ec) {
+                    connection->cancel_timeout();
+                    if(on_error)
+                        on_error(request, ec);
+                    return;
+                }
+                request->streambuf.commit(bytes_transferred);
+                metrics.add(Metrics::Counter::bytes_received, bytes_transferred);
+                if(bytes_transferred<remaining)
+                    this->read_sized_content(connection, request, remaining-bytes_transferred);
+                else {
+                    connection->cancel_timeout();
+                    this->find_resource(connection, request);
+                }
+            }));
+        }
+
+        /// Decodes chunked content into Request::streambuf, then calls find_resource
+        void read_chunked_content(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {
+            auto &read_buffer=connection->read_buffer;
+            while(true) {
+                auto data=static_cast<const char*>(asio::buffer_cast<const void*>(read_buffer.data()));
+                size_t consumed, piece_size;
+                const char *piece;
+                auto result=request->chunked_decoder.next(data, read_buffer.size(), consumed, piece, piece_size);
+                if(result==ChunkedDecoder::Result::bad_request) {
+                    write_error_and_close(connection, request, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    return;
+                }
+                if(result==ChunkedDecoder::Result::content) {
+                    if(piece_size>config.max_request_content_size-request->streambuf.size()) {
+                        write_error_and_close(connection, request, "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                        return;
                     }
+                    request->streambuf.commit(asio::buffer_copy(request->streambuf.prepare(piece_size), asio::buffer(piece, piece_size)));
                 }
-                else
-                    return false;
+                read_buffer.consume(consumed);
+                if(result==ChunkedDecoder::Result::complete) {
+                    connection->cancel_timeout();
+                    find_resource(connection, request);
+                    return;
+                }
+                if(result==ChunkedDecoder::Result::incomplete)
+                    break;
+            }
+            //Set timeout on the following asio::async-read or write function. No responses are pending here.
+            connection->set_timeout(config.timeout_content);
+            connection->socket.async_read_some(read_buffer.prepare(config.content_window), make_handler(connection->handler_memory,
+                    [this, connection, request](const error_code& ec, size_t bytes_transferred) {
+                if(ec) {
+                    connection->cancel_timeout();
+                    if(on_error)
+                        on_error(request, ec);
+                    return;
+                }
+                connection->read_buffer.commit(bytes_transferred);
+                metrics.add(Metrics::Counter::bytes_received, bytes_transferred);
+                this->read_chunked_content(connection, request);
+            }));
+        }
+
+        /// Hands the next piece of streamed content to handler, reading from the socket if none has been received
+        void read_content(Request &request, const std::function<void(const error_code&, asio::const_buffer)> &handler) {
+            auto connection=request.content_connection;
+            if(!connection) { //No content, or all of it has been read
+                handler(error_code(), asio::const_buffer());
+                return;
+            }
+            auto &read_buffer=connection->read_buffer;
+            read_buffer.consume(request.content_consume);
+            request.content_consume=0;
+            if(read_buffer.size()==0) {
+                deliver_content(connection, request, handler);
+                return;
+            }
+            //Called later, since handler typically calls read_content() again
+            asio::post(connection->socket.get_executor(), make_handler(connection->handler_memory, [this, connection, &request, handler] {
+                this->deliver_content(connection, request, handler);
+            }));
+        }
+
+        void read_content_some(const std::shared_ptr<Connection> &connection, Request &request,
+                               const std::function<void(const error_code&, asio::const_buffer)> &handler) {
+            //Set timeout on the following asio::async-read or write function
+            connection->set_timeout(config.timeout_content);
+            auto &read_buffer=connection->read_buffer;
+            connection->socket.async_read_some(read_buffer.prepare(config.content_window),
+                    make_handler(connection->handler_memory, [this, connection, &request, handler](const error_code& ec, size_t bytes_transferred) {
+                if(ec) {
+                    this->end_content(connection, request, ec, handler);
+                    return;
+                }
+                connection->read_buffer.commit(bytes_transferred);
+                metrics.add(Metrics::Counter::bytes_received, bytes_transferred);
+                this->deliver_content(connection, request, handler);
+            }));
+        }
+
+        /// Hands the next piece of streamed content in read_buffer to handler
+        void deliver_content(const std::shared_ptr<Connection> &connection, Request &request,
+                             const std::function<void(const error_code&, asio::const_buffer)> &handler) {
+            auto &read_buffer=connection->read_buffer;
+            auto data=static_cast<const char*>(asio::buffer_cast<const void*>(read_buffer.data()));
+            const char *piece=data;
+            size_t piece_size=0;
+            bool end;
+            if(request.chunked) {
+                size_t consumed;
+                auto result=request.chunked_decoder.next(data, read_buffer.size(), consumed, piece, piece_size);
+                if(result==ChunkedDecoder::Result::bad_request) {
+                    end_content(connection, request, make_error_code::make_error_code(errc::protocol_error), handler);
+                    return;
+                }
+                if(result==ChunkedDecoder::Result::content)
+                    request.content_consume=consumed;
+                else {
+                    piece_size=0;
+                    read_buffer.consume(consumed);
+                }
+                end=result==ChunkedDecoder::Result::complete;
+            }
+            else {
+                piece_size=static_cast<size_t>(std::min(static_cast<unsigned long long>(read_buffer.size()), request.content_remaining));
+                request.content_remaining-=piece_size;
+                request.content_consume=piece_size;
+                end=request.content_remaining==0 && piece_size==0;
             }
+            if(piece_size>0)
+                handler(error_code(), asio::buffer(piece, piece_size));
+            else if(end)
+                end_content(connection, request, error_code(), handler);
             else
+                read_content_some(connection, request, handler);
+        }
+
+        /// Called once the streamed content has been read, or could not be. The read path then continues with the next request.
+        void end_content(const std::shared_ptr<Connection> &connection, Request &request, const error_code &ec,
+                         const std::function<void(const error_code&, asio::const_buffer)> &handler) {
+            request.content_connection.reset();
+            if(ec) {
+                //The rest of the content cannot be skipped
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->closing=true;
+            }
+            handler(ec, asio::const_buffer());
+            if(!ec)
+                read_request_and_content(connection);
+        }
+
+        /// Stops the read path if responses are pending; it is resumed once they have been sent.
+        /// Returns false if there are none, in which case the caller reads from the socket.
+        bool wait_for_responses(Connection &connection) const {
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            if(connection.count==0)
                 return false;
+            connection.reading=false;
             return true;
         }
 
-        void find_resource(const std::shared_ptr<socket_type> &socket, const std::shared_ptr<Request> &request) {          
-            //Find path- and method-match, and call write_response
-            auto it=default_resource.find(request->method);
+        /// Waits for the next request on a keep-alive connection
+        void read_next_request(const std::shared_ptr<Connection> &connection) {
+            connection->set_timeout(connection->read_buffer.size()>0 ? config.timeout_request : config.timeout_idle_keepalive);
+            read_request_and_content(connection);
+        }
+
+        /// Copies the request line and headers found by the parser into request
+        void parse_request(const std::shared_ptr<Request> &request) const {
+            auto &parser=request->parser;
+            request->method.assign(parser.method().data(), parser.method().size());
+            request->path.assign(parser.path().data(), parser.path().size());
+            request->http_version.assign(parser.http_version().data(), parser.http_version().size());
+            for(size_t c=0;c<parser.headers_size();c++) {
+                auto header=parser.header(c);
+                request->add_header(header.name, header.value);
+            }
+        }
+
+        /// Sends a constant response, for instance to a malformed request, after the pending responses,
+        /// and closes the connection
+        void write_error_and_close(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
+                                   const char *error_response) {
+            metrics.add(Metrics::Counter::bad_requests);
+            write_and_close(connection, request, asio::buffer(error_response, std::strlen(error_response)));
+            if(on_error)
+                on_error(request, make_error_code::make_error_code(errc::protocol_error));
+        }
+
+        /// Answers a request that arrives while the server is overloaded with overload_response, before it is parsed
+        void shed_request(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {
+            metrics.add(Metrics::Counter::shed_requests);
+            write_and_close(connection, request, asio::buffer(overload_response));
+        }
+
+        void write_and_close(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
+                             asio::const_buffer constant_response) {
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->closing=true;
+            }
+            write_response(connection, request, [constant_response](std::shared_ptr<Response> response, std::shared_ptr<Request> /*request*/) {
+                response->write_buffer(constant_response, nullptr);
+                response->close_connection_after_response=true;
+            });
+        }
+
+        /// Finds the resource of request. Returns true if it streams the content.
+        bool route_request(Request &request) const {
+            const Resource *resource=nullptr;
+            auto result=router.find(request.method, request.path, resource, request.path_parameters, request.allow);
+            if(result==Router<Resource>::Result::found) {
+                request.resource_function=&resource->function;
+                request.offload=resource->offload;
+                request.cache_policy=resource->cache_policy.get();
+                return resource->stream_content;
+            }
+            //Also for a path that matches a route, but not for this method, before answering 405
+            auto it=default_resource.find(request.method);
             if(it!=default_resource.end()) {
-                write_response(socket, request, it->second);
+                request.resource_function=&it->second;
+                request.allow=nullptr;
+                request.path_parameters.clear();
+                auto cache_it=default_resource_cache.find(request.method);
+                if(cache_it!=default_resource_cache.end())
+                    request.cache_policy=&cache_it->second;
+            }
+            return false;
+        }
+
+        void find_resource(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request) {          
+            if(request->chunked || request->streambuf.size()>0)
+                metrics.record(Metrics::Stage::read_content, request->header_received, Metrics::now());
+
+            //Call write_response with the resource found by route_request
+            if(request->resource_function) {
+                write_response(connection, request, *request->resource_function, request->offload);
+                return;
+            }
+
+            //The path matched a route, but not for this method
+            if(auto allow=request->allow) {
+                write_response(connection, request, [allow](std::shared_ptr<Response> response, std::shared_ptr<Request> /*request*/) {
+                    response->write_status(405).write_header("Allow", *allow).write_header("Content-Length", 0).end_header();
+                });
+            }
+            else {
+                write_response(connection, request, [](std::shared_ptr<Response> response, std::shared_ptr<Request> /*request*/) {
+                    response->write_status(404).write_header("Content-Length", 0).end_header();
+                });
             }
         }
         
-        void write_response(const std::shared_ptr<socket_type> &socket, const std::shared_ptr<Request> &request, 
-                std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>,
-                                   std::shared_ptr<typename ServerBase<socket_type>::Request>)>& resource_function) {
-            //Set timeout on the following asio::async-read or write function
-            auto timer=this->get_timeout_timer(socket, config.timeout_content);
-
-            auto response=std::shared_ptr<Response>(new Response(socket), [this, request, timer](Response *response_ptr) {
-                auto response=std::shared_ptr<Response>(response_ptr);
-                this->send(response, [this, response, request, timer](const error_code& ec) {
-                    if(timer)
-                        timer->cancel();
-                    if(!ec) {
-                        if (response->close_connection_after_response)
-                            return;
-
-                        auto range=request->header.equal_range("Connection");
-                        for(auto it=range.first;it!=range.second;it++) {
-                            if(case_insensitive_equal(it->second, "close")) {
-                                return;
-                            } else if (case_insensitive_equal(it->second, "keep-alive")) {
-                                this->read_request_and_content(response->socket);
-                                return;
-                            }
-                        }
-                        if(request->http_version >= "1.1")
-                            this->read_request_and_content(response->socket);
+        /// Calls resource_function, on the OffloadExecutor if offload is true, or answers from the response cache
+        void write_response(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request, 
+                const ResourceFunction& resource_function, bool offload=false) {
+            //The Response in the pipeline slot of the request is reused. It is sent when the application releases it,
+            //and the control block lives in the connection's handler memory.
+            Response *response_ptr;
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                auto &exchange=connection->slot(connection->count);
+                if(!exchange.response)
+                    exchange.response=std::unique_ptr<Response>(new Response());
+                response_ptr=exchange.response.get();
+                response_ptr->connection=connection;
+                //Set timeout on the following asio::async-read or write function
+                if(connection->count++==0)
+                    connection->set_timeout(config.timeout_content);
+                if(!keep_alive(*request))
+                    connection->closing=true;
+            }
+            requests_in_progress.fetch_add(1, std::memory_order_relaxed);
+            //Determined before the resource function may start reading the content
+            auto stream_content=request->content_connection!=nullptr;
+            auto response=std::shared_ptr<Response>(response_ptr, [this, connection](Response *response_ptr) {
+                this->release_response(connection, response_ptr);
+            }, HandlerAllocator<Response>(connection->handler_memory));
+
+            metrics.add(Metrics::Counter::requests);
+            if(connection->requests++>0)
+                metrics.add(Metrics::Counter::keep_alive_requests);
+            if(!request->cache_policy || !response_cache || !find_cached_response(connection, request, response, resource_function, offload))
+                run_resource_function(connection, request, response, resource_function, offload);
+            response.reset();
+
+            //Handle the next pipelined request if it has been received already, or read it.
+            //With streamed content, this happens once the content has been read.
+            if(!stream_content)
+                read_request_and_content(connection);
+        }
+
+        /// Calls resource_function with response, on the OffloadExecutor if offload is true
+        void run_resource_function(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
+                                   const std::shared_ptr<Response> &response, const ResourceFunction &resource_function, bool offload) {
+            if(offload) {
+                auto queued=Metrics::now();
+                auto function=&resource_function;
+                if(offload_executor->post([this, connection, request, response, function, queued]() mutable {
+                    auto handler_start=Metrics::now();
+                    metrics.add(Metrics::Counter::offload_started);
+                    metrics.record(Metrics::Stage::offload_wait, queued, handler_start);
+                    this->call_resource_function(*function, response, request, handler_start);
+                    //Released, and so sent, on the io_service of the connection
+                    asio::post(connection->socket.get_executor(), [response=std::move(response)]() mutable {
+                        response.reset();
+                    });
+                }))
+                    metrics.add(Metrics::Counter::offload_queued);
+                else {
+                    metrics.add(Metrics::Counter::offload_rejected);
+                    {
+                        std::lock_guard<std::mutex> lock(connection->mutex);
+                        connection->closing=true;
                     }
-                    else if(on_error)
-                        on_error(request, ec);
+                    response->write_buffer(asio::buffer(overload_response), nullptr);
+                    response->close_connection_after_response=true;
+                }
+            }
+            else
+                call_resource_function(resource_function, response, request, Metrics::now());
+        }
+
+        /// Answers request from the response cache, or queues it behind the request producing the response for the
+        /// same key. Returns false if resource_function is to be called, and its response fills the cache.
+        bool find_cached_response(const std::shared_ptr<Connection> &connection, const std::shared_ptr<Request> &request,
+                                  const std::shared_ptr<Response> &response, const ResourceFunction &resource_function, bool offload) {
+            auto &key=response->cache_key;
+            key.assign(request->method).append(" ").append(request->path);
+            for(auto &name: request->cache_policy->vary) {
+                key+='\n';
+                auto it=request->header.find(name);
+                if(it!=request->header.end())
+                    key+=it->second;
+            }
+            std::shared_ptr<const ResponseCache::Entry> entry;
+            auto function=&resource_function;
+            auto result=response_cache->find(key, entry, [this, &connection, &request, &response, function, offload] {
+                return ResponseCache::Waiter([this, connection, request, response, function, offload](const std::shared_ptr<const ResponseCache::Entry> &entry) {
+                    //Answered on the io_service of the connection, since the response being filled may be on another one
+                    asio::post(connection->socket.get_executor(), [this, connection, request, response=response, function, offload, entry]() mutable {
+                        if(entry)
+                            response->write_buffer(asio::buffer(entry->data), entry);
+                        else
+                            this->run_resource_function(connection, request, response, *function, offload);
+                        response.reset();
+                    });
                 });
             });
+            if(result==ResponseCache::Lookup::hit) {
+                metrics.add(Metrics::Counter::cache_hits);
+                response->write_buffer(asio::buffer(entry->data), entry);
+                return true;
+            }
+            if(result==ResponseCache::Lookup::wait) {
+                metrics.add(Metrics::Counter::cache_coalesced);
+                return true;
+            }
+            metrics.add(Metrics::Counter::cache_misses);
+            response->cache_fill=request->cache_policy;
+            return false;
+        }
+
+        /// Fills the cache entry of a released response, or gives up if the response cannot be cached
+        void fill_cache(Response &response) {
+            auto policy=response.cache_fill;
+            response.cache_fill=nullptr;
+            if(response.close_connection_after_response || response.status_code()!=200) {
+                response_cache->abandon(response.cache_key);
+                return;
+            }
+            std::vector<asio::const_buffer> buffers;
+            response.append_buffers(buffers);
+            std::string data;
+            data.reserve(response.size());
+            for(auto &buffer: buffers)
+                data.append(asio::buffer_cast<const char*>(buffer), asio::buffer_size(buffer));
+            if(!is_complete_response(data)) {
+                response_cache->abandon(response.cache_key);
+                return;
+            }
+            response_cache->fill(response.cache_key, std::move(data), policy->ttl);
+        }
+
+        /// Returns true if data holds a header that has ended, followed by all of the content it announces
+        /// with Content-Length or Transfer-Encoding: chunked
+        static bool is_complete_response(boost::string_view data) {
+            auto header_end=data.find("\r\n\r\n");
+            if(header_end==boost::string_view::npos)
+                return false;
+            auto content=data.substr(header_end+4);
+            //The header lines after the status line
+            for(auto line_start=data.find("\r\n")+2;line_start<header_end+2;) {
+                auto line_end=data.find("\r\n", line_start);
+                auto line=data.substr(line_start, line_end-line_start);
+                line_start=line_end+2;
+                auto colon=line.find(':');
+                if(colon==boost::string_view::npos)
+                    continue;
+                auto name=line.substr(0, colon);
+                auto value=line.substr(colon+1);
+                while(!value.empty() && (value.front()==' ' || value.front()=='\t'))
+                    value.remove_prefix(1);
+                while(!value.empty() && (value.back()==' ' || value.back()=='\t'))
+                    value.remove_suffix(1);
+                if(boost::algorithm::iequals(name, "Content-Length")) {
+                    unsigned long long length;
+                    return parse_decimal(value, length) && length==content.size();
+                }
+                if(boost::algorithm::iequals(name, "Transfer-Encoding"))
+                    return boost::algorithm::iends_with(value, "chunked") && ChunkedDecoder().is_complete(content.data(), content.size());
+            }
+            return false;
+        }
 
+        void call_resource_function(const ResourceFunction &resource_function, const std::shared_ptr<Response> &response,
+                                    const std::shared_ptr<Request> &request, Metrics::TimePoint handler_start) {
             try {
                 resource_function(response, request);
             }
             catch(const std::exception &e) {
-                if(on_error)
-                    on_error(request, make_error_code::make_error_code(errc::operation_canceled));
+                resource_function_failed(response, request);
+            }
+            metrics.record(Metrics::Stage::handler, handler_start, Metrics::now());
+        }
+
+        /// Called when a resource function, or the coroutine it started, ends with an exception. What has been written
+        /// is incomplete, so it is neither cached nor sent.
+        void resource_function_failed(const std::shared_ptr<Response> &response, const std::shared_ptr<Request> &request) {
+            if(response->cache_fill) {
+                response->cache_fill=nullptr;
+                response_cache->abandon(response->cache_key);
+            }
+            if(!response->sending) {
+                response->clear_buffers();
+                response->streambuf.consume(response->streambuf.size());
+                response->clear();
+                response->write_status(500).write_header("Content-Length", 0).end_header();
+            }
+            else //Part of it may have been sent already
+                response->close_connection_after_response=true;
+            if(on_error)
+                on_error(request, make_error_code::make_error_code(errc::operation_canceled));
+        }
+
+        bool keep_alive(const Request &request) const {
+            auto range=request.header.equal_range("Connection");
+            for(auto it=range.first;it!=range.second;it++) {
+                if(case_insensitive_equal(it->second, "close"))
+                    return false;
+                else if(case_insensitive_equal(it->second, "keep-alive"))
+                    return true;
+            }
+            return request.http_version >= "1.1";
+        }
+
+        /// Called when the application releases a response. What is left of it is sent once the earlier responses have been sent.
+        void release_response(const std::shared_ptr<Connection> &connection, Response *response) {
+            //Before locking, since the waiters for the entry may be on this connection
+            if(response->cache_fill)
+                fill_cache(*response);
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            response->released=true;
+            response->released_time=Metrics::now();
+            if(connection->closed)
+                response->connection.reset();
+            else if(connection->is_head(response) && !connection->writing)
+                write_responses(connection);
+        }
+
+        /// Sends the released responses at the head of the pipeline with one gather write, or performs a send()
+        /// that waited for the head. Called with the connection locked.
+        void write_responses(const std::shared_ptr<Connection> &connection) {
+            auto &buffers=connection->write_buffers;
+            buffers.clear();
+            size_t responses=0;
+            for(;responses<connection->count;responses++) {
+                auto &response=*connection->slot(responses).response;
+                if(!response.released)
+                    break;
+                response.append_buffers(buffers);
+            }
+            if(responses==0) {
+                auto &response=*connection->slot(0).response;
+                if(response.pending_send_response) {
+                    auto pending_response=std::move(response.pending_send_response);
+                    auto callback=std::move(response.pending_send_callback);
+                    response.pending_send_callback=nullptr;
+                    send_head(pending_response, callback);
+                }
                 return;
             }
+            connection->writing=true;
+            connection->set_timeout(config.timeout_content);
+            asio::async_write(connection->socket, BufferSequence(buffers), make_handler(connection->handler_memory,
+                    [this, connection, responses](const error_code &ec, size_t bytes_transferred) {
+                metrics.add(Metrics::Counter::bytes_sent, bytes_transferred);
+                this->responses_sent(connection, responses, ec);
+            }));
+        }
+
+        /// Copies a record of request and its response to the ring of the calling thread
+        void log_access(const Request &request, Response &response, Metrics::TimePoint sent) {
+            auto record=access_log->reserve();
+            if(!record) {
+                metrics.add(Metrics::Counter::access_log_dropped);
+                return;
+            }
+            response.account_sent();
+            record->time=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+#ifndef WEB_SERVER_NO_METRICS
+            auto duration=std::chrono::duration_cast<std::chrono::nanoseconds>(sent-request.received).count();
+            record->duration=duration>0 ? static_cast<uint64_t>(duration) : 0;
+#else
+            (void)sent;
+            record->duration=0;
+#endif
+            record->bytes=response.sent_bytes;
+            record->status=static_cast<uint16_t>(response.sent_status);
+            record->port=request.remote_endpoint_port;
+            record->set_method(request.method);
+            record->set_version(request.http_version);
+            record->set_address(request.remote_endpoint_address);
+            record->set_path(request.path);
+            access_log->commit();
+        }
+
+        void responses_sent(const std::shared_ptr<Connection> &connection, size_t responses, const error_code &ec) {
+            std::shared_ptr<Request> request;
+            bool close_connection=false, resume_reading=false;
+            std::vector<std::pair<std::shared_ptr<Response>, std::function<void(const error_code&)>>> pending_sends;
+            auto sent=Metrics::now();
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->writing=false;
+                for(size_t c=0;c<responses;c++) {
+                    auto &exchange=connection->slot(0);
+                    metrics.record(Metrics::Stage::write, exchange.response->released_time, sent);
+                    metrics.record(Metrics::Stage::request, exchange.request->received, sent);
+                    if(access_log)
+                        log_access(*exchange.request, *exchange.response, sent);
+                    //Content that the application did not read cannot be skipped
+                    if(exchange.response->close_connection_after_response || exchange.request->content_connection) {
+                        exchange.request->content_connection.reset();
+                        close_connection=true;
+                    }
+                    exchange.response->reset();
+                    exchange.response->connection.reset();
+                    if(ec)
+                        request=exchange.request;
+                    connection->head=(connection->head+1)%connection->pipeline.size();
+                    connection->count--;
+                }
+                requests_in_progress.fetch_sub(responses, std::memory_order_relaxed);
+                if(ec || close_connection) {
+                    //Responses to later pipelined requests are dropped. Those still held by the application
+                    //release the connection when they are released.
+                    connection->closing=true;
+                    connection->closed=true;
+                    for(size_t c=0;c<connection->count;c++) {
+                        auto &response=*connection->slot(c).response;
+                        if(response.released)
+                            response.connection.reset();
+                        if(response.pending_send_response) {
+                            pending_sends.emplace_back(std::move(response.pending_send_response), std::move(response.pending_send_callback));
+                            response.pending_send_callback=nullptr;
+                        }
+                    }
+                }
+                else if(connection->count>0) {
+                    write_responses(connection);
+                    return;
+                }
+                else if(connection->reading) //The read path is still busy with buffered requests and reads on its own
+                    connection->set_timeout(config.timeout_idle_keepalive);
+                else if(!connection->closing)
+                    resume_reading=connection->reading=true;
+                else
+                    connection->cancel_timeout();
+            }
+            if(ec || close_connection) {
+                connection->cancel_timeout();
+                connection->close();
+                for(auto &pending_send: pending_sends) {
+                    if(pending_send.second)
+                        pending_send.second(make_error_code::make_error_code(errc::operation_canceled));
+                }
+                if(ec && on_error)
+                    on_error(request, ec);
+                return;
+            }
+            if(resume_reading)
+                read_next_request(connection);
         }
     };
     
@@ -401,26 +1844,51 @@ namespace SimpleWeb {
         Server() : ServerBase<HTTP>::ServerBase(80) {}
         
     protected:
-        void accept() {
-            //Create new socket for this connection
+        void accept(size_t index) {
+            auto &acceptor=*acceptors[index];
+            if(!acceptor.is_open())
+                return;
+            //Create new connection, on the io_service of the acceptor
             //Shared_ptr is used to pass temporary objects to the asynchronous functions
-            auto socket=std::make_shared<HTTP>(*io_service);
+            auto connection=std::make_shared<Connection>(timer_wheels[index], acceptor.get_executor());
                         
-            acceptor->async_accept(*socket, [this, socket](const error_code& ec){
-                //Immediately start accepting a new connection (if io_service hasn't been stopped)
-                if (ec != asio::error::operation_aborted)
-                    accept();
-                                
-                if(!ec) {
-                    asio::ip::tcp::no_delay option(true);
-                    socket->set_option(option);
-                    
-                    this->read_request_and_content(socket);
+            acceptor.async_accept(connection->socket, [this, index, connection](const error_code& ec){
+                if(ec==asio::error::operation_aborted)
+                    return;
+                if(ec) {
+                    if(this->accept_failed(index, connection, ec))
+                        accept(index);
+                    return;
+                }
+                auto accept_more=this->connection_accepted(*connection, index);
+                this->start_connection(connection);
+
+                //Take the connections that are already waiting, up to accept_batch, before returning to the io_service
+                auto &acceptor=*acceptors[index];
+                for(size_t c=1;c<config.accept_batch && accept_more;c++) {
+                    auto next_connection=std::make_shared<Connection>(timer_wheels[index], acceptor.get_executor());
+                    error_code ec;
+                    acceptor.accept(next_connection->socket, ec);
+                    if(ec==asio::error::would_block || ec==asio::error::try_again)
+                        break;
+                    if(ec) {
+                        accept_more=this->accept_failed(index, next_connection, ec);
+                        break;
+                    }
+                    accept_more=this->connection_accepted(*next_connection, index);
+                    this->start_connection(next_connection);
                 }
-                else if(on_error)
-                    on_error(std::shared_ptr<Request>(new Request(*socket)), ec);
+                if(accept_more)
+                    accept(index);
             });
         }
+
+        void start_connection(const std::shared_ptr<Connection> &connection) {
+            error_code ec;
+            connection->socket.set_option(asio::ip::tcp::no_delay(true), ec);
+            connection->set_timeout(config.timeout_request);
+            this->read_request_and_content(connection);
+        }
     };
 }
 #endif	/* SERVER_HTTP_HPP */
@@ -0,0 +1,127 @@
+#ifndef SERVER_IO_URING_HPP
+#define	SERVER_IO_URING_HPP
+
+#include "server_http.hpp"
+#include "io_uring.hpp"
+
+namespace SimpleWeb {
+    typedef UringSocket HTTP_URING;
+
+    /// HTTP server whose sockets are driven by io_uring instead of epoll, with the same resources and Config.
+    /// Each io_service gets an IoUring. Connections are accepted with a multishot accept, so config.accept_batch
+    /// does not apply, and received with a multishot receive into buffers provided to the kernel. The submissions
+    /// made while handling a batch of completions are handed to the kernel together.
+    template<>
+    class Server<HTTP_URING> : public ServerBase<HTTP_URING> {
+    public:
+        Server() : ServerBase<HTTP_URING>::ServerBase(80) {}
+
+        /// Size of the submission ring of each io_service
+        unsigned ring_entries=1024;
+        /// Number, a power of two, and size of the receive buffers provided to the kernel by each io_service
+        unsigned receive_buffers=512;
+        size_t receive_buffer_size=8192;
+
+        void stop() override {
+            for(size_t c=0;c<accept_operations.size();c++) {
+                auto &operation=*accept_operations[c];
+                std::lock_guard<std::mutex> lock(operation.mutex);
+                operation.rearm=false;
+                if(operation.armed && !operation.cancelling) {
+                    operation.cancelling=true;
+                    rings[c]->cancel(&operation);
+                    rings[c]->flush();
+                }
+            }
+            ServerBase<HTTP_URING>::stop();
+        }
+
+    protected:
+        /// The multishot accept on acceptors[index]
+        class AcceptOperation : public IoUring::Operation {
+        public:
+            AcceptOperation(Server &server, size_t index) : server(server), index(index) {}
+
+            Server &server;
+            size_t index;
+            /// Guards the flags below
+            std::mutex mutex;
+            /// True while the multishot accept is submitted
+            bool armed=false;
+            bool cancelling=false;
+            /// Accept again once the cancelled multishot accept has completed
+            bool rearm=false;
+
+            void complete(int result, unsigned flags) override {
+                server.accept_completed(*this, result, flags);
+            }
+        };
+
+        std::vector<std::shared_ptr<IoUring>> rings;
+        std::vector<std::unique_ptr<AcceptOperation>> accept_operations;
+
+        void io_services_created() override {
+            rings.clear();
+            accept_operations.clear();
+            for(size_t c=0;c<io_services.size();c++) {
+                rings.emplace_back(std::make_shared<IoUring>(*io_services[c], ring_entries, receive_buffers, receive_buffer_size));
+                rings.back()->start();
+                accept_operations.emplace_back(new AcceptOperation(*this, c));
+            }
+        }
+
+        void accept(size_t index) override {
+            auto &acceptor=*acceptors[index];
+            if(!acceptor.is_open())
+                return;
+            auto &operation=*accept_operations[index];
+            std::lock_guard<std::mutex> lock(operation.mutex);
+            if(operation.armed) {
+                if(operation.cancelling)
+                    operation.rearm=true;
+                return;
+            }
+            operation.armed=true;
+            rings[index]->accept_multishot(acceptor.native_handle(), &operation);
+        }
+
+        void accept_completed(AcceptOperation &operation, int result, unsigned flags) {
+            auto index=operation.index;
+            bool accept_more=true;
+            if(result>=0) {
+                auto connection=std::make_shared<Connection>(timer_wheels[index], *rings[index], result);
+                accept_more=this->connection_accepted(*connection, index);
+                this->start_connection(connection);
+            }
+            else if(result!=-ECANCELED) {
+                auto connection=std::make_shared<Connection>(timer_wheels[index], *rings[index]);
+                accept_more=this->accept_failed(index, connection, error_code(-result, boost::system::system_category()));
+            }
+
+            std::unique_lock<std::mutex> lock(operation.mutex);
+            if(flags & IORING_CQE_F_MORE) {
+                //Stop the multishot accept while paused or backing off, accept(index) is called when it may resume
+                if(!accept_more && !operation.cancelling) {
+                    operation.cancelling=true;
+                    rings[index]->cancel(&operation);
+                }
+                return;
+            }
+            operation.armed=false;
+            operation.cancelling=false;
+            auto rearm=result==-ECANCELED ? operation.rearm : accept_more;
+            operation.rearm=false;
+            lock.unlock();
+            if(rearm)
+                accept(index);
+        }
+
+        void start_connection(const std::shared_ptr<Connection> &connection) {
+            error_code ec;
+            connection->socket.set_option(asio::ip::tcp::no_delay(true), ec);
+            connection->set_timeout(config.timeout_request);
+            this->read_request_and_content(connection);
+        }
+    };
+}
+#endif	/* SERVER_IO_URING_HPP */
@@ -0,0 +1,539 @@
+#ifndef STATIC_FILE_CACHE_HPP
+#define	STATIC_FILE_CACHE_HPP
+#include <atomic>
+#include <ctime>
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+#include "compression.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace SimpleWeb {
+    namespace asio = boost::asio;
+
+    /// In-memory cache of the files below a web root, keyed by the normalized request path.
+    ///
+    /// Each entry holds the file body, either loaded or memory mapped, and the preformatted response headers,
+    /// so that a hit is answered without any filesystem access. Entries are dropped as soon as inotify reports
+    /// a change to the file. Files should be replaced by renaming over them rather than truncated in place,
+    /// since a memory mapped body may still be in flight. Paths that cannot be cached, directories and files too
+    /// large or beyond the memory budget, are remembered as such until they change too.
+    ///
+    /// Precompressed siblings of a file, file.br and file.gz, are loaded with it and served to the clients that
+    /// accept them. Files of compressible types without a sibling are compressed with gzip on first use,
+    /// and kept in a least recently used side cache with its own memory budget.
+    class StaticFileCache {
+    public:
+        class Entry {
+            friend class StaticFileCache;
+        public:
+            ~Entry() {
+                if(mapped)
+                    munmap(mapped, body_size);
+            }
+
+            /// Complete header block of the 200 response, including the empty line
+            std::string header;
+            /// Complete header block of the 304 response, including the empty line
+            std::string not_modified_header;
+            std::string etag;
+            std::string last_modified;
+            time_t modified=0;
+            /// ContentEncoding of the body
+            unsigned content_encoding=ContentEncoding::identity;
+
+            asio::const_buffer body() const {
+                return mapped ? asio::const_buffer(mapped, body_size) : asio::const_buffer(loaded.data(), loaded.size());
+            }
+            size_t size() const {
+                return body_size;
+            }
+
+            /// Returns true if the client's copy is still valid according to the If-None-Match or,
+            /// in its absence, the If-Modified-Since request header. Pass nullptr for absent headers.
+            bool is_not_modified(const std::string *if_none_match, const std::string *if_modified_since) const {
+                if(if_none_match)
+                    return *if_none_match=="*" || if_none_match->find(etag)!=std::string::npos;
+                if(if_modified_since) {
+                    if(*if_modified_since==last_modified)
+                        return true;
+                    struct tm tm={};
+                    if(strptime(if_modified_since->c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+                        return modified<=timegm(&tm);
+                }
+                return false;
+            }
+        private:
+            Entry() {}
+            std::string loaded;
+            void *mapped=nullptr;
+            size_t body_size=0;
+            int watch=-1;
+            time_t loaded_at=0;
+            /// False if the path is not a regular file or is too large, in which case the entry is only watched
+            bool cacheable=true;
+            /// Precompressed siblings. Those older than the file are only watched, so that the file is reloaded
+            /// once they are brought up to date.
+            std::shared_ptr<Entry> br, gzip;
+            bool use_br=false, use_gzip=false;
+            bool compressible=false;
+
+            /// Size of the body and the siblings
+            size_t cached_size() const {
+                return body_size+(br ? br->body_size : 0)+(gzip ? gzip->body_size : 0);
+            }
+            bool is_watching(int watch) const {
+                return this->watch==watch || (br && br->watch==watch) || (gzip && gzip->watch==watch);
+            }
+        };
+
+        /// Files up to this size are read into memory. Defaults to 64 KB.
+        size_t load_threshold=65536;
+        /// Larger files are memory mapped, up to this size. Files above it are not cached. Defaults to 8 MB.
+        size_t max_file_size=8*1024*1024;
+        /// Files are not cached once the cached bodies reach this total size. Defaults to 256 MB.
+        size_t max_total_size=256*1024*1024;
+        /// Files of compressible types from this size are compressed with gzip for the clients that accept it,
+        /// unless they have a precompressed sibling. Defaults to 256 bytes.
+        size_t min_compress_size=256;
+        /// Larger files are only served compressed from a precompressed sibling. Defaults to 1 MB.
+        size_t max_compress_size=1024*1024;
+        /// The files compressed on first use are kept up to this total size, dropping the least recently used.
+        /// Defaults to 32 MB.
+        size_t max_compressed_total_size=32*1024*1024;
+        /// zlib level of the files compressed on first use. Defaults to 6.
+        int compression_level=6;
+
+        /// root is the web root directory. Changes to the cached files are watched on io_service,
+        /// which must not run handlers after the cache has been destroyed.
+        StaticFileCache(asio::io_service &io_service, const std::string &root) : root(root), inotify(io_service) {
+#ifdef __linux__
+            auto fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(fd>=0) {
+                inotify.assign(fd);
+                read_events();
+            }
+#endif
+        }
+
+        /// Returns the entry for request_path, loading it on first use.
+        /// Returns nullptr if the path is invalid, not a regular file or not cacheable.
+        std::shared_ptr<const Entry> get(const std::string &request_path) {
+            std::string key;
+            if(!normalize(request_path, key))
+                return nullptr;
+            return get_key(key);
+        }
+
+        /// Returns the entry for request_path in the best of accepted_encodings, ContentEncoding flags usually
+        /// found with accepted_encodings() from the Accept-Encoding request header. That is a precompressed sibling,
+        /// preferably br, or else for a compressible type, the file compressed with gzip. Falls back to the file itself.
+        /// Returns nullptr if the path is invalid, not a regular file or not cacheable.
+        std::shared_ptr<const Entry> get(const std::string &request_path, unsigned accepted_encodings) {
+            std::string key;
+            if(!normalize(request_path, key))
+                return nullptr;
+            auto entry=get_key(key);
+            if(!entry)
+                return nullptr;
+            if((accepted_encodings & ContentEncoding::br) && entry->use_br)
+                return entry->br;
+            if(accepted_encodings & ContentEncoding::gzip) {
+                if(entry->use_gzip)
+                    return entry->gzip;
+                if(entry->compressible)
+                    return get_compressed(key, entry);
+            }
+            return entry;
+        }
+
+        /// Maps a file extension to a Content-Type, defaulting to application/octet-stream
+        static const char *content_type(const std::string &path) {
+            static const std::vector<std::pair<std::string, const char*>> types={
+                {".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"}, {".css", "text/css"},
+                {".js", "application/javascript"}, {".json", "application/json"}, {".txt", "text/plain; charset=utf-8"},
+                {".svg", "image/svg+xml"}, {".png", "image/png"}, {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"},
+                {".gif", "image/gif"}, {".ico", "image/x-icon"}, {".wasm", "application/wasm"}, {".xml", "application/xml"}};
+            auto dot=path.rfind('.');
+            if(dot!=std::string::npos) {
+                for(auto &type: types) {
+                    if(path.compare(dot, std::string::npos, type.first)==0)
+                        return type.second;
+                }
+            }
+            return "application/octet-stream";
+        }
+
+        static std::string http_date(time_t time) {
+            struct tm tm;
+            gmtime_r(&time, &tm);
+            char buffer[64];
+            return std::string(buffer, strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+        }
+
+    private:
+        std::string root;
+        asio::posix::stream_descriptor inotify;
+        alignas(8) char events_buffer[4096];
+
+        std::mutex entries_mutex;
+        std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+        /// Keys that cannot be cached, with the watch of the path and when it was checked
+        struct Uncacheable {
+            int watch;
+            time_t checked_at;
+        };
+        std::unordered_map<std::string, Uncacheable> uncacheable;
+        /// The keys each watch is registered for, once per entry being loaded or cached
+        std::unordered_multimap<int, std::string> watches;
+        size_t total_size=0;
+
+        /// A file compressed on first use, or nullptr if compression did not pay off, and the ETag of the file
+        struct Compressed {
+            std::string key;
+            std::string etag;
+            std::shared_ptr<const Entry> entry;
+        };
+        std::mutex compressed_mutex;
+        /// Most recently used first
+        std::list<Compressed> compressed;
+        std::unordered_map<std::string, std::list<Compressed>::iterator> compressed_index;
+        size_t compressed_total_size=0;
+
+        std::shared_ptr<const Entry> get_key(const std::string &key) {
+            {
+                std::lock_guard<std::mutex> lock(entries_mutex);
+                auto it=entries.find(key);
+                if(it!=entries.end()) {
+                    //Without inotify, entries are revalidated once per second
+                    if(inotify.is_open() || it->second->loaded_at==time(nullptr))
+                        return it->second;
+                    total_size-=it->second->cached_size();
+                    entries.erase(it);
+                }
+                auto uncacheable_it=uncacheable.find(key);
+                if(uncacheable_it!=uncacheable.end()) {
+                    if(inotify.is_open() || uncacheable_it->second.checked_at==time(nullptr))
+                        return nullptr;
+                    uncacheable.erase(uncacheable_it);
+                }
+            }
+
+            auto entry=load(key);
+            if(!entry)
+                return nullptr;
+            std::lock_guard<std::mutex> lock(entries_mutex);
+            auto it=entries.find(key);
+            //Loaded by another thread, or changed, in the meantime
+            if(it!=entries.end() || uncacheable.count(key)>0 || !is_watched(*entry, key)) {
+                remove_watches(*entry, key);
+                return it!=entries.end() ? it->second : nullptr;
+            }
+            if(!entry->cacheable || total_size+entry->cached_size()>max_total_size) {
+                //Served from the file system until the file changes
+                for(auto file: {entry->br.get(), entry->gzip.get()}) {
+                    if(file)
+                        remove_watch(file->watch, key);
+                }
+                uncacheable.emplace(key, Uncacheable{entry->watch, time(nullptr)});
+                return nullptr;
+            }
+            total_size+=entry->cached_size();
+            entries.emplace(key, entry);
+            return entry;
+        }
+
+        /// Returns entry compressed with gzip, from the side cache if it has been compressed before
+        std::shared_ptr<const Entry> get_compressed(const std::string &key, const std::shared_ptr<const Entry> &entry) {
+            {
+                std::lock_guard<std::mutex> lock(compressed_mutex);
+                auto it=compressed_index.find(key);
+                if(it!=compressed_index.end()) {
+                    if(it->second->etag==entry->etag) {
+                        compressed.splice(compressed.begin(), compressed, it->second);
+                        return it->second->entry ? it->second->entry : entry;
+                    }
+                    erase_compressed(it);
+                }
+            }
+
+            auto body=entry->body();
+            auto content=gzip(asio::buffer_cast<const char*>(body), entry->size(), compression_level);
+            std::shared_ptr<Entry> compressed_entry;
+            //Not worth a Content-Encoding unless it saves an eighth
+            if(content.size()<entry->size()-entry->size()/8) {
+                compressed_entry=std::shared_ptr<Entry>(new Entry());
+                compressed_entry->loaded=std::move(content);
+                compressed_entry->body_size=compressed_entry->loaded.size();
+                compressed_entry->modified=entry->modified;
+                compressed_entry->last_modified=entry->last_modified;
+                compressed_entry->etag=entry->etag;
+                compressed_entry->etag.insert(compressed_entry->etag.size()-1, "-gzip");
+                compressed_entry->content_encoding=ContentEncoding::gzip;
+                format_headers(*compressed_entry, key, true);
+            }
+
+            std::lock_guard<std::mutex> lock(compressed_mutex);
+            auto size=compressed_entry ? compressed_entry->size() : 0;
+            if(compressed_index.count(key)==0 && size<=max_compressed_total_size) {
+                compressed.push_front(Compressed{key, entry->etag, compressed_entry});
+                compressed_index.emplace(key, compressed.begin());
+                compressed_total_size+=size;
+                while(compressed_total_size>max_compressed_total_size)
+                    erase_compressed(compressed_index.find(compressed.back().key));
+            }
+            return compressed_entry ? compressed_entry : entry;
+        }
+
+        /// Called with compressed_mutex locked
+        void erase_compressed(std::unordered_map<std::string, std::list<Compressed>::iterator>::iterator it) {
+            if(it->second->entry)
+                compressed_total_size-=it->second->entry->size();
+            compressed.erase(it->second);
+            compressed_index.erase(it);
+        }
+
+        /// Strips the query, collapses repeated slashes, rejects . and .. segments and maps directories to index.html
+        static bool normalize(const std::string &request_path, std::string &key) {
+            auto end=request_path.find('?');
+            if(end==std::string::npos)
+                end=request_path.size();
+            key.reserve(end+10);
+            size_t segment_start=0;
+            for(size_t c=0;c<end;c++) {
+                if(request_path[c]=='/') {
+                    if(!key.empty() && key.back()=='/')
+                        continue;
+                    if(key.size()>segment_start && (key.compare(segment_start, std::string::npos, ".")==0 ||
+                                                    key.compare(segment_start, std::string::npos, "..")==0))
+                        return false;
+                    key+='/';
+                    segment_start=key.size();
+                }
+                else if(request_path[c]=='\0' || request_path[c]=='\\')
+                    return false;
+                else {
+                    if(key.empty())
+                        return false;
+                    key+=request_path[c];
+                }
+            }
+            if(key.empty())
+                return false;
+            if(key.compare(segment_start, std::string::npos, ".")==0 || key.compare(segment_start, std::string::npos, "..")==0)
+                return false;
+            if(key.back()=='/')
+                key+="index.html";
+            return true;
+        }
+
+        /// Loads the file at key and its precompressed siblings
+        std::shared_ptr<Entry> load(const std::string &key) {
+            auto entry=load_file(root+key, key);
+            if(!entry || !entry->cacheable)
+                return entry;
+            auto type=content_type(key);
+            entry->br=load_file(root+key+".br", key);
+            entry->gzip=load_file(root+key+".gz", key);
+            entry->use_br=entry->br && entry->br->cacheable && entry->br->modified>=entry->modified;
+            entry->use_gzip=entry->gzip && entry->gzip->cacheable && entry->gzip->modified>=entry->modified;
+            entry->compressible=!entry->use_gzip && is_compressible(type) && entry->size()>=min_compress_size &&
+                                entry->size()<=max_compress_size;
+            format_headers(*entry, key, entry->use_br || entry->use_gzip || entry->compressible);
+            if(entry->use_br) {
+                entry->br->content_encoding=ContentEncoding::br;
+                entry->br->etag.insert(entry->br->etag.size()-1, "-br");
+                format_headers(*entry->br, key, true);
+            }
+            if(entry->use_gzip) {
+                entry->gzip->content_encoding=ContentEncoding::gzip;
+                entry->gzip->etag.insert(entry->gzip->etag.size()-1, "-gzip");
+                format_headers(*entry->gzip, key, true);
+            }
+            return entry;
+        }
+
+        /// Loads the body and validators of the file at path, without the headers, and watches it for key.
+        /// Returns nullptr if it cannot be read, and an entry that is not cacheable if it is not a regular file
+        /// or is too large.
+        std::shared_ptr<Entry> load_file(const std::string &path, const std::string &key) {
+            auto fd=::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd<0)
+                return nullptr;
+            struct stat st;
+            if(fstat(fd, &st)!=0) {
+                ::close(fd);
+                return nullptr;
+            }
+            std::shared_ptr<Entry> entry(new Entry());
+            auto fail=[&]() -> std::shared_ptr<Entry> {
+                ::close(fd);
+                std::lock_guard<std::mutex> lock(entries_mutex);
+                remove_watch(entry->watch, key);
+                return nullptr;
+            };
+            //Watched before reading, so that a change during loading is not missed. A file renamed over the path
+            //since it was opened is caught by comparing the inodes.
+            if(inotify.is_open()) {
+                entry->watch=add_watch(path, key);
+                struct stat path_st;
+                if(entry->watch<0 || stat(path.c_str(), &path_st)!=0 || path_st.st_ino!=st.st_ino || path_st.st_dev!=st.st_dev)
+                    return fail();
+            }
+            if(!S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size)>max_file_size) {
+                ::close(fd);
+                entry->cacheable=false;
+                entry->loaded_at=time(nullptr);
+                return entry;
+            }
+            entry->body_size=static_cast<size_t>(st.st_size);
+            if(entry->body_size<=load_threshold) {
+                entry->loaded.resize(entry->body_size);
+                size_t position=0;
+                while(position<entry->body_size) {
+                    auto read_length=::read(fd, &entry->loaded[position], entry->body_size-position);
+                    if(read_length<=0)
+                        return fail();
+                    position+=static_cast<size_t>(read_length);
+                }
+            }
+            else {
+                auto mapped=mmap(nullptr, entry->body_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapped==MAP_FAILED)
+                    return fail();
+                entry->mapped=mapped;
+            }
+            ::close(fd);
+
+            entry->modified=st.st_mtime;
+            entry->loaded_at=time(nullptr);
+            entry->last_modified=http_date(st.st_mtime);
+            char etag[64];
+            snprintf(etag, sizeof(etag), "\"%llx-%llx\"", static_cast<unsigned long long>(st.st_mtime),
+                     static_cast<unsigned long long>(st.st_size));
+            entry->etag=etag;
+            return entry;
+        }
+
+        /// Watches path and registers the watch for key. Returns the watch descriptor, or -1.
+        int add_watch(const std::string &path, const std::string &key) {
+#ifdef __linux__
+            std::lock_guard<std::mutex> lock(entries_mutex);
+            auto watch=inotify_add_watch(inotify.native_handle(), path.c_str(),
+                                         IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+            if(watch>=0)
+                watches.emplace(watch, key);
+            return watch;
+#else
+            return -1;
+#endif
+        }
+
+        /// Unregisters watch for key, and removes the watch once no key is registered for it.
+        /// Called with entries_mutex locked.
+        void remove_watch(int watch, const std::string &key) {
+            if(watch<0)
+                return;
+            auto range=watches.equal_range(watch);
+            for(auto it=range.first;it!=range.second;++it) {
+                if(it->second==key) {
+                    watches.erase(it);
+#ifdef __linux__
+                    if(watches.count(watch)==0)
+                        inotify_rm_watch(inotify.native_handle(), watch);
+#endif
+                    return;
+                }
+            }
+        }
+
+        /// Called with entries_mutex locked
+        void remove_watches(const Entry &entry, const std::string &key) {
+            for(auto file: std::initializer_list<const Entry*>{&entry, entry.br.get(), entry.gzip.get()}) {
+                if(file)
+                    remove_watch(file->watch, key);
+            }
+        }
+
+        /// Returns false if a watch of entry has reported a change since it was registered for key.
+        /// Called with entries_mutex locked.
+        bool is_watched(const Entry &entry, const std::string &key) const {
+            for(auto file: std::initializer_list<const Entry*>{&entry, entry.br.get(), entry.gzip.get()}) {
+                if(!file || file->watch<0)
+                    continue;
+                auto range=watches.equal_range(file->watch);
+                auto it=range.first;
+                while(it!=range.second && it->second!=key)
+                    ++it;
+                if(it==range.second)
+                    return false;
+            }
+            return true;
+        }
+
+        /// Formats the headers of entry, a variant of the file at key if vary is true
+        static void format_headers(Entry &entry, const std::string &key, bool vary) {
+            std::string validators="ETag: "+entry.etag+"\r\nLast-Modified: "+entry.last_modified+"\r\n";
+            if(vary)
+                validators+="Vary: Accept-Encoding\r\n";
+            std::string encoding;
+            if(entry.content_encoding==ContentEncoding::gzip)
+                encoding="Content-Encoding: gzip\r\n";
+            else if(entry.content_encoding==ContentEncoding::br)
+                encoding="Content-Encoding: br\r\n";
+            entry.header="HTTP/1.1 200 OK\r\nContent-Length: "+std::to_string(entry.body_size)+"\r\nContent-Type: "+
+                         content_type(key)+"\r\n"+encoding+validators+"\r\n";
+            entry.not_modified_header="HTTP/1.1 304 Not Modified\r\n"+validators+"\r\n";
+        }
+
+        void read_events() {
+#ifdef __linux__
+            inotify.async_read_some(asio::buffer(events_buffer), [this](const boost::system::error_code &ec, size_t bytes_transferred) {
+                if(ec)
+                    return;
+                std::lock_guard<std::mutex> lock(entries_mutex);
+                for(size_t position=0;position<bytes_transferred;) {
+                    auto event=reinterpret_cast<const inotify_event*>(events_buffer+position);
+                    auto range=watches.equal_range(event->wd);
+                    for(auto it=range.first;it!=range.second;++it) {
+                        auto entry_it=entries.find(it->second);
+                        if(entry_it!=entries.end() && entry_it->second->is_watching(event->wd)) {
+                            total_size-=entry_it->second->cached_size();
+                            //The other watches of the entry, on the siblings, are no longer needed
+                            for(auto file: {entry_it->second.get(), entry_it->second->br.get(), entry_it->second->gzip.get()}) {
+                                if(file && file->watch!=event->wd)
+                                    remove_watch(file->watch, it->second);
+                            }
+                            entries.erase(entry_it);
+                            std::lock_guard<std::mutex> lock(compressed_mutex);
+                            auto compressed_it=compressed_index.find(it->second);
+                            if(compressed_it!=compressed_index.end())
+                                erase_compressed(compressed_it);
+                        }
+                        auto uncacheable_it=uncacheable.find(it->second);
+                        if(uncacheable_it!=uncacheable.end() && uncacheable_it->second.watch==event->wd)
+                            uncacheable.erase(uncacheable_it);
+                    }
+                    watches.erase(range.first, range.second);
+                    if(!(event->mask & IN_IGNORED))
+                        inotify_rm_watch(inotify.native_handle(), event->wd);
+                    position+=sizeof(inotify_event)+event->len;
+                }
+                read_events();
+            });
+#endif
+        }
+    };
+}
+#endif	/* STATIC_FILE_CACHE_HPP */
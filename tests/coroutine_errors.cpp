@@ -0,0 +1,101 @@
+#include "server_http.hpp"
+#include "coroutine_handler.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+using namespace std;
+typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
+
+//Checks what is sent when a coroutine resource function throws, before and after it has been suspended. Requires C++20.
+//Exits with failure if any check fails.
+
+namespace {
+    const unsigned short port=18084;
+    int failures=0;
+
+    void check(bool condition, const string &what) {
+        if(!condition) {
+            cerr << "failed: " << what << endl;
+            failures++;
+        }
+    }
+
+    //Sends text on a new connection and returns what is received until the server closes it.
+    //" <timeout>" is appended if the server keeps the connection open for more than two seconds.
+    string exchange(const string &text) {
+        int fd=socket(AF_INET, SOCK_STREAM, 0);
+        timeval timeout={2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in address={};
+        address.sin_family=AF_INET;
+        address.sin_port=htons(port);
+        address.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        string received;
+        if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))!=0 ||
+           write(fd, text.data(), text.size())!=static_cast<ssize_t>(text.size())) {
+            close(fd);
+            return received;
+        }
+        char buffer[4096];
+        while(true) {
+            auto length=read(fd, buffer, sizeof(buffer));
+            if(length<0)
+                received+=" <timeout>";
+            if(length<=0)
+                break;
+            received.append(buffer, static_cast<size_t>(length));
+        }
+        close(fd);
+        return received;
+    }
+}
+
+int main() {
+    HttpServer server;
+    server.config.port=port;
+    //Throws before its first co_await, with half a header written
+    server.route("GET", "/throw", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) -> SimpleWeb::CoroutineHandler {
+        response->write_status(200).write_header("Content-Type", "text/plain");
+        throw runtime_error("coroutine failed");
+        co_return;
+    });
+    //Throws once it has been resumed, with half a header written
+    server.route("GET", "/sleep-throw", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) -> SimpleWeb::CoroutineHandler {
+        response->write_status(200).write_header("Content-Type", "text/plain");
+        co_await SimpleWeb::sleep_for(response, chrono::milliseconds(10));
+        throw runtime_error("coroutine failed");
+    });
+    //Throws once part of the response has been sent
+    server.route("GET", "/flush-throw", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) -> SimpleWeb::CoroutineHandler {
+        *response << "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc";
+        co_await SimpleWeb::flush(response);
+        throw runtime_error("coroutine failed");
+    });
+    server.route("GET", "/ok", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> /*request*/) {
+        response->write_status(200).write_header("Content-Length", 2).end_header();
+        *response << "ok";
+    });
+    thread server_thread([&server]() {
+        server.start();
+    });
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    const string internal_server_error="HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+    const string ok="HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+    //Replaced by a 500, and the connection stays usable
+    auto received=exchange("GET /throw HTTP/1.1\r\n\r\nGET /ok HTTP/1.1\r\nConnection: close\r\n\r\n");
+    check(received==internal_server_error+ok, "coroutine throwing before co_await answered with 500: "+received);
+    received=exchange("GET /sleep-throw HTTP/1.1\r\n\r\nGET /ok HTTP/1.1\r\nConnection: close\r\n\r\n");
+    check(received==internal_server_error+ok, "coroutine throwing after co_await answered with 500: "+received);
+
+    //What has been sent cannot be taken back, so the connection is closed after it
+    received=exchange("GET /flush-throw HTTP/1.1\r\n\r\n");
+    check(received=="HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc", "connection closed after a partly sent response: "+received);
+
+    server.stop();
+    server_thread.join();
+
+    cout << (failures==0 ? "all checks passed" : to_string(failures)+" checks failed") << endl;
+    return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+#ifndef TIMER_WHEEL_HPP
+#define	TIMER_WHEEL_HPP
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace SimpleWeb {
+    namespace asio = boost::asio;
+
+    /// Hashed timing wheel driving the timeouts of all connections on one io_service.
+    ///
+    /// Timeouts are rounded up to whole ticks and hashed into one of the wheel's slots by their expiry tick.
+    /// The entries are intrusive, so scheduling, rescheduling and cancelling are O(1) and do not allocate.
+    /// A single asio timer ticks the wheel, and only while it holds entries.
+    class TimerWheel : public std::enable_shared_from_this<TimerWheel> {
+    public:
+        /// Base class of objects with a timeout, typically connections.
+        class Entry {
+            friend class TimerWheel;
+        public:
+            virtual ~Entry() {}
+        protected:
+            /// Called on the io_service of the wheel when the timeout expires. The entry is no longer scheduled.
+            /// Must not schedule or cancel entries of the same wheel.
+            virtual void timeout()=0;
+        private:
+            Entry *previous=nullptr, *next=nullptr;
+            uint64_t expiry_tick=0;
+            bool scheduled=false;
+        };
+
+        TimerWheel(asio::io_service &io_service, std::chrono::milliseconds tick=std::chrono::milliseconds(100), size_t slots=512) :
+                timer(io_service), tick(tick), slots(slots, nullptr), start(std::chrono::steady_clock::now()) {}
+
+        /// Schedules entry to time out after duration, replacing any earlier timeout of the entry
+        void schedule(Entry &entry, std::chrono::milliseconds duration) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(entry.scheduled)
+                unlink(entry);
+            if(!ticking) {
+                current_tick=now_tick();
+                lag_ms.store(0, std::memory_order_relaxed);
+            }
+            //Round up, so that the timeout is at least duration
+            entry.expiry_tick=current_tick+static_cast<uint64_t>((duration+tick-std::chrono::milliseconds(1))/tick)+1;
+            link(entry);
+            if(!ticking) {
+                ticking=true;
+                arm();
+            }
+        }
+
+        void cancel(Entry &entry) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(entry.scheduled)
+                unlink(entry);
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return count;
+        }
+
+        /// How late the last tick ran, that is how far behind the io_service was. 0 while the wheel is idle.
+        std::chrono::milliseconds lag() const {
+            return std::chrono::milliseconds(lag_ms.load(std::memory_order_relaxed));
+        }
+
+    private:
+        asio::steady_timer timer;
+        std::chrono::milliseconds tick;
+        std::vector<Entry*> slots;
+        std::chrono::steady_clock::time_point start;
+
+        std::mutex mutex;
+        uint64_t current_tick=0;
+        size_t count=0;
+        bool ticking=false;
+        std::atomic<int64_t> lag_ms{0};
+
+        uint64_t now_tick() const {
+            return static_cast<uint64_t>((std::chrono::steady_clock::now()-start)/tick);
+        }
+
+        Entry *&slot(uint64_t tick) {
+            return slots[tick%slots.size()];
+        }
+
+        void link(Entry &entry) {
+            auto &head=slot(entry.expiry_tick);
+            entry.previous=nullptr;
+            entry.next=head;
+            if(head)
+                head->previous=&entry;
+            head=&entry;
+            entry.scheduled=true;
+            count++;
+        }
+
+        void unlink(Entry &entry) {
+            if(entry.previous)
+                entry.previous->next=entry.next;
+            else
+                slot(entry.expiry_tick)=entry.next;
+            if(entry.next)
+                entry.next->previous=entry.previous;
+            entry.previous=entry.next=nullptr;
+            entry.scheduled=false;
+            count--;
+        }
+
+        void arm() {
+            auto self=shared_from_this();
+            timer.expires_at(start+tick*(current_tick+1));
+            timer.async_wait([self](const boost::system::error_code &ec) {
+                if(!ec)
+                    self->advance();
+            });
+        }
+
+        /// Expires the entries of every tick that has passed, catching up if the io_service was busy
+        void advance() {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto now=std::chrono::steady_clock::now();
+            auto late=std::chrono::duration_cast<std::chrono::milliseconds>(now-(start+tick*(current_tick+1)));
+            lag_ms.store(std::max(late.count(), static_cast<int64_t>(0)), std::memory_order_relaxed);
+            auto target=static_cast<uint64_t>((now-start)/tick);
+            while(current_tick<target && count>0) {
+                current_tick++;
+                auto entry=slot(current_tick);
+                while(entry) {
+                    auto next=entry->next;
+                    //Entries of later rounds share the slot
+                    if(entry->expiry_tick<=current_tick) {
+                        unlink(*entry);
+                        entry->timeout();
+                    }
+                    entry=next;
+                }
+            }
+            current_tick=target;
+            if(count>0)
+                arm();
+            else {
+                ticking=false;
+                lag_ms.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+}
+#endif	/* TIMER_WHEEL_HPP */
@@ -1,36 +1,147 @@
 #include "server_http.hpp"
-#include <fstream>
+#include "static_file_cache.hpp"
+#include "compression.hpp"
 #include <boost/filesystem.hpp>
+#include <fstream>
 #include <vector>
 #include <algorithm>
 using namespace std;
 typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
 
-void default_resource_send(const HttpServer &server, const shared_ptr<HttpServer::Response> &response,
-                           const shared_ptr<ifstream> &ifs);
+//Returns true if the canonical path is root or below it. Compared by components, since /web is a text prefix of /webx.
+bool is_within(const boost::filesystem::path &root, const boost::filesystem::path &path) {
+    auto mismatch=std::mismatch(root.begin(), root.end(), path.begin(), path.end());
+    return mismatch.first==root.end();
+}
+
+//Sends each piece of the content back as a chunk, and reads the next piece once it has been sent
+void echo_content(HttpServer &server, const shared_ptr<HttpServer::Response> &response, const shared_ptr<HttpServer::Request> &request) {
+    request->read_content([&server, response, request](const SimpleWeb::error_code &ec, boost::asio::const_buffer piece) {
+        if(ec)
+            return;
+        auto size=boost::asio::buffer_size(piece);
+        if(size==0) {
+            response->write_last_chunk();
+            return;
+        }
+        response->write_chunk(boost::asio::buffer_cast<const char*>(piece), size);
+        server.send(response, [&server, response, request](const SimpleWeb::error_code &ec) {
+            if(!ec)
+                echo_content(server, response, request);
+        });
+    });
+}
 
 int main() {
     HttpServer server;
     server.config.port=8080;
+    server.io_service=make_shared<boost::asio::io_service>();
+
+    //Requests are logged to access.log by a background thread
+    server.access_log=make_shared<SimpleWeb::AccessLog>("access.log");
+
+    //Files below web are served from memory, and revalidated when they change
+    SimpleWeb::StaticFileCache cache(*server.io_service, "web");
     
+    //Route-example: GET /hello/{name} responds with a greeting
+    server.route("GET", "/hello/{name}", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+        auto content="Hello "+request->path_parameters.get("name").to_string()+"!";
+        response->write_status(200).write_date_header().write_header("Content-Length", content.length()).end_header();
+        *response << content;
+    });
+
+    //Streaming-example: POST /echo responds with the content as it arrives, without buffering all of it
+    server.route("POST", "/echo", [&server](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+        *response << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+        echo_content(server, response, request);
+    }, true);
+
+    //Compression-example: GET /numbers/{count} responds with count lines, compressed with gzip if the client accepts it
+    //and the content reaches 1 KB. The responses are cached for 5 seconds, separately for each Accept-Encoding.
+    server.route("GET", "/numbers/{count}", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+        //Checked before anything is written, and bounded so that one request cannot produce gigabytes
+        unsigned long long count;
+        if(!SimpleWeb::parse_decimal(request->path_parameters.get("count"), count) || count>1000000) {
+            string content="count must be a number from 0 to 1000000";
+            response->write_status(400).write_header("Content-Length", content.length()).end_header();
+            *response << content;
+            return;
+        }
+        auto accept_encoding=request->header.find("Accept-Encoding");
+        SimpleWeb::CompressedContentWriter<HttpServer::Response> content(response,
+            accept_encoding!=request->header.end() ? SimpleWeb::accepted_encodings(accept_encoding->second) : 0);
+        response->write_status(200).write_header("Content-Type", "text/plain");
+        for(unsigned long long c=0;c<count;c++)
+            content.write(to_string(c)+"\n");
+        content.end();
+    }, HttpServer::CachePolicy{chrono::seconds(5), {"Accept-Encoding"}});
+
+    //Offload-example: GET /lines/* responds with the number of lines of a file below web. The file is read with
+    //blocking I/O, so the resource function runs on a worker thread instead of holding up the other connections.
+    server.route("GET", "/lines/*", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+        string content;
+        try {
+            auto web_root_path=boost::filesystem::canonical("web");
+            auto path=boost::filesystem::canonical(web_root_path/request->path_parameters.get("*").to_string());
+            if(!is_within(web_root_path, path))
+                throw invalid_argument("path must be within root path");
+            ifstream ifs(path.string(), ifstream::in | ifstream::binary);
+            if(!ifs)
+                throw invalid_argument("could not read file");
+            size_t lines=0;
+            string line;
+            while(getline(ifs, line))
+                lines++;
+            content=to_string(lines)+"\n";
+            response->write_status(200);
+        }
+        catch(const exception &e) {
+            content=string("Could not count lines: ")+e.what();
+            response->write_status(400);
+        }
+        response->write_header("Content-Length", content.length()).end_header();
+        *response << content;
+    }, false, true);
+
+    //Counters and latency histograms of the server, in the Prometheus text format
+    server.route("GET", "/metrics", server.metrics_resource());
+
     //GET-example.
-    server.default_resource["GET"]=[&server](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+    server.default_resource["GET"]=[&server, &cache](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
+        //Served precompressed or compressed with gzip if the client accepts it
+        auto accept_encoding=request->header.find("Accept-Encoding");
+        auto entry=cache.get(request->path, accept_encoding!=request->header.end() ?
+                             SimpleWeb::accepted_encodings(accept_encoding->second) : 0);
+        if(entry) {
+            auto if_none_match=request->header.find("If-None-Match");
+            auto if_modified_since=request->header.find("If-Modified-Since");
+            if(entry->is_not_modified(if_none_match!=request->header.end() ? &if_none_match->second : nullptr,
+                                      if_modified_since!=request->header.end() ? &if_modified_since->second : nullptr))
+                response->write_buffer(boost::asio::buffer(entry->not_modified_header), entry);
+            else {
+                response->write_buffer(boost::asio::buffer(entry->header), entry);
+                response->write_buffer(entry->body(), entry);
+            }
+            return;
+        }
+
+        //Not cacheable, for instance a directory without trailing slash or a large file
         try {
             auto web_root_path=boost::filesystem::canonical("web");
             auto path=boost::filesystem::canonical(web_root_path/request->path);
-            
             if(boost::filesystem::is_directory(path))
-                path/="index.html";
+                path=boost::filesystem::canonical(path/"index.html");
+            if(!is_within(web_root_path, path))
+                throw invalid_argument("path must be within root path");
 
-            auto ifs=make_shared<ifstream>();
-            ifs->open(path.string(), ifstream::in | ios::binary | ios::ate);
+            auto file=make_shared<SimpleWeb::File>(path.string());
             
-            if(*ifs) {
-                auto length=ifs->tellg();
-                ifs->seekg(0, ios::beg);
-                
-                *response << "HTTP/1.1 200 OK\r\n" << "Content-Length: " << length << "\r\n\r\n";
-                default_resource_send(server, response, ifs);
+            if(*file) {
+                *response << "HTTP/1.1 200 OK\r\n" << "Content-Length: " << file->size() << "\r\n\r\n";
+                server.send_file(response, file, 0, file->size(), [](const SimpleWeb::error_code &ec) {
+                    if(ec)
+                        cerr << "Connection interrupted" << endl;
+                });
             }
             else
                 throw invalid_argument("could not read file");
@@ -50,21 +161,3 @@ int main() {
     server_thread.join();
     return 0;
 }
-
-void default_resource_send(const HttpServer &server, const shared_ptr<HttpServer::Response> &response,
-                           const shared_ptr<ifstream> &ifs) {
-    //read and send 128 KB at a time
-    static vector<char> buffer(131072); // Safe when server is running on one thread
-    streamsize read_length;
-    if((read_length=ifs->read(&buffer[0], buffer.size()).gcount())>0) {
-        response->write(&buffer[0], read_length);
-        if(read_length==static_cast<streamsize>(buffer.size())) {
-            server.send(response, [&server, response, ifs](const SimpleWeb::error_code &ec) {
-                if(!ec)
-                    default_resource_send(server, response, ifs);
-                else
-                    cerr << "Connection interrupted" << endl;
-            });
-        }
-    }
-}
@@ -0,0 +1,57 @@
+#include "server_http.hpp"
+#include "coroutine_handler.hpp"
+#include <chrono>
+#include <string>
+using namespace std;
+typedef SimpleWeb::Server<SimpleWeb::HTTP> HttpServer;
+
+//Resource functions written as C++20 coroutines. Requires a C++20 compiler.
+
+int main() {
+    HttpServer server;
+    server.config.port=8081;
+
+    //Streaming-example: POST /echo responds with the content as it arrives, without buffering all of it
+    server.route("POST", "/echo", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) -> SimpleWeb::CoroutineHandler {
+        *response << "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+        while(true) {
+            auto content=co_await SimpleWeb::read_content(request);
+            if(content.ec)
+                co_return;
+            response->write_chunk(static_cast<const char*>(content.data.data()), content.data.size());
+            //Waits until the piece has been sent before reading the next one
+            if(content.data.size()==0 || co_await SimpleWeb::flush(response))
+                co_return;
+        }
+    }, true);
+
+    //Timer-example: GET /countdown/{seconds} sends a line every second
+    server.route("GET", "/countdown/{seconds}", [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) -> SimpleWeb::CoroutineHandler {
+        //Bounded, so that a request cannot hold the connection for an arbitrary time
+        unsigned long long seconds;
+        if(!SimpleWeb::parse_decimal(request->path_parameters.get("seconds"), seconds) || seconds>60) {
+            string content="seconds must be a number from 0 to 60";
+            response->write_status(400).write_header("Content-Length", content.length()).end_header();
+            *response << content;
+            co_return;
+        }
+        response->write_status(200).write_header("Content-Type", "text/plain").write_header("Transfer-Encoding", "chunked").end_header();
+        for(auto c=seconds;c>0;c--) {
+            auto line=to_string(c)+"\n";
+            response->write_chunk(line.data(), line.size());
+            if(co_await SimpleWeb::flush(response) || co_await SimpleWeb::sleep_for(response, chrono::seconds(1)))
+                co_return;
+        }
+        response->write_last_chunk();
+    });
+
+    thread server_thread([&server](){
+        server.start();
+    });
+    this_thread::sleep_for(chrono::seconds(1));
+
+    cout << "SUCCESS" << endl;
+
+    server_thread.join();
+    return 0;
+}